@@ -1,6 +1,8 @@
 #include "AssetManager.h"
 
 #include "Logger.h"
+#include "Utils.h"
+#include "ThreadPool.h"
 #include <cctype>
 
 AssetManager::~AssetManager() {
@@ -63,22 +65,168 @@ void AssetManager::load() {
 			default: break;
 		}
 	}
+
+	if (!m_atlasFolders.empty()) {
+		buildAtlas();
+	}
+	buildMipChains();
+}
+
+// Normal and specular maps hold data, not color, and are filtered without gamma
+static bool isColorImage(const String& fileName) {
+	return fileName.find("normal") == String::npos && fileName.find("specular") == String::npos;
+}
+
+void AssetManager::buildMipChains() {
+	double start = Utils::currentTime();
+
+	struct Job {
+		ImageData* image;
+		CompressedImage* chain;
+		bool srgb;
+	};
+	Vec<Job> jobs;
+	for (auto&& kv : m_images) {
+		if (m_atlas.find(kv.first)) continue;
+		jobs.push_back({ kv.second.get(), &m_mipChains[kv.first], isColorImage(kv.first) });
+	}
+	m_atlasMipChains.resize(m_atlas.pageCount());
+	for (u32 i = 0; i < m_atlas.pageCount(); i++) {
+		jobs.push_back({ &m_atlas.page(i), &m_atlasMipChains[i], true });
+	}
+
+	// One image per job, the row loops inside run inline
+	ThreadPool::get().parallelFor(u32(jobs.size()), 1, [&](u32 begin, u32 end) {
+		for (u32 i = begin; i < end; i++) {
+			*jobs[i].chain = TextureCompressor::encode(*jobs[i].image, FormatRGBA8, jobs[i].srgb);
+		}
+	});
+
+	LogInfo("Built ", jobs.size(), " mip chains in ", (Utils::currentTime() - start) * 1000.0, " ms");
+}
+
+void AssetManager::buildAtlas() {
+	Vec<std::pair<String, ImageData*>> images;
+	for (auto&& kv : m_images) {
+		for (auto&& folder : m_atlasFolders) {
+			if (kv.first.compare(0, folder.size(), folder) == 0) {
+				images.push_back({ kv.first, kv.second.get() });
+				break;
+			}
+		}
+	}
+
+	m_atlas.build(images);
+	m_atlasPages.resize(m_atlas.pageCount());
+	LogInfo("Packed ", images.size(), " images into ", m_atlas.pageCount(), " atlas pages");
+}
+
+Texture2D AssetManager::getAtlasPage(u32 page) {
+	Texture2D& tex = m_atlasPages[page];
+	if (tex.id() == 0) {
+		tex = Texture2DFactory::create()
+			.setFilter(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR)
+			.setWrap(GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE)
+			.setData(m_atlasMipChains[page]);
+		m_atlasMipChains[page] = CompressedImage{};
+	}
+	return tex;
 }
 
 void AssetManager::addImage(const String& fileName) {
 	m_assetQueue.push_back({ AssetType::Image, fileName });
 }
 
+void AssetManager::addAtlasFolder(const String& folder) {
+	m_atlasFolders.push_back(folder);
+}
+
 Texture2D AssetManager::getTexture(const String& imageFile) {
-	if (m_textures.find(imageFile) == m_textures.end()) {
-		Texture2D tex = Texture2DFactory::create()
+	auto it = m_textures.find(imageFile);
+	if (it != m_textures.end()) {
+		return it->second;
+	}
+	if (std::this_thread::get_id() != m_glThread) {
+		LogError("Texture not uploaded: \"", imageFile, "\"");
+		return Texture2D();
+	}
+
+	Texture2D tex;
+	if (const AtlasRegion* region = m_atlas.find(imageFile)) {
+		tex = getAtlasPage(region->page).subTexture(region->x, region->y, region->width, region->height);
+	} else if (auto chain = m_mipChains.find(imageFile); chain != m_mipChains.end()) {
+		tex = Texture2DFactory::create()
+			.setFilter(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR)
+			.setWrap(GL_REPEAT, GL_REPEAT)
+			.setData(chain->second);
+		m_mipChains.erase(chain);
+	} else {
+		tex = Texture2DFactory::create()
 			.setFilter(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR)
 			.setWrap(GL_REPEAT, GL_REPEAT)
 			.setData(*getImage(imageFile))
 			.generateMipmaps();
-		m_textures.insert({ imageFile, tex });
 	}
-	return m_textures[imageFile];
+	m_textures.insert({ imageFile, tex });
+	return tex;
+}
+
+Material AssetManager::getMaterial(const String& color, const String& normal, const String& specular) {
+	auto it = m_materials.find(color);
+	if (it != m_materials.end()) {
+		return it->second;
+	}
+	if (std::this_thread::get_id() != m_glThread) {
+		LogError("Material not uploaded: \"", color, "\"");
+		return Material{};
+	}
+
+	auto find = [&](const String& fileName) -> ImageData* {
+		auto img = m_images.find(fileName);
+		return img != m_images.end() ? img->second.get() : nullptr;
+	};
+
+	ImageData* colorImage = find(color);
+	if (!colorImage) {
+		LogError("Material color map not loaded: \"", color, "\"");
+		return Material{};
+	}
+
+	Material mat = m_materialLibrary.add(*colorImage, find(normal), find(specular));
+	m_materials.insert({ color, mat });
+
+	// The library made its own (compressed) mips
+	for (const String* name : { &color, &normal, &specular }) {
+		m_mipChains.erase(*name);
+	}
+	return mat;
+}
+
+void AssetManager::uploadMaterials() {
+	const String suffix = "/color.tga";
+	Vec<String> folders;
+	for (auto&& kv : m_images) {
+		const String& name = kv.first;
+		if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+			folders.push_back(name.substr(0, name.size() - suffix.size()));
+		}
+	}
+
+	// Sorted, so materials get the same pages and layers on every run
+	std::sort(folders.begin(), folders.end());
+	for (auto&& dir : folders) {
+		getMaterial(dir + suffix, dir + "/normal.tga", dir + "/specular.tga");
+	}
+}
+
+void AssetManager::uploadTextures() {
+	for (auto&& kv : m_images) {
+		// Material maps dropped their mip chains in getMaterial, uploading them here
+		// would make a second, uncompressed copy through the generateMipmaps path
+		if (m_atlas.find(kv.first) || m_mipChains.find(kv.first) != m_mipChains.end()) {
+			getTexture(kv.first);
+		}
+	}
 }
 
 int AssetManager::getFile(const String& fileName) {
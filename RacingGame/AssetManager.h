@@ -3,10 +3,14 @@
 
 #include "ImageData.h"
 #include "Texture.h"
+#include "Material.h"
+#include "TextureAtlas.h"
 #include "Collections.h"
 
 #include "miniz.h"
 
+#include <thread>
+
 using ZIPFile = mz_zip_archive;
 
 enum AssetType {
@@ -20,26 +24,60 @@ struct Asset {
 
 class AssetManager {
 public:
-	AssetManager() = default;
+	AssetManager() : m_glThread(std::this_thread::get_id()) {}
 	~AssetManager();
 
 	void init(const String& zipFile);
 	void load();
 
 	void addImage(const String& fileName);
+
+	// Images under these folders are packed into atlas pages by load(), their
+	// textures from getTexture are regions of a page. Not for repeating textures.
+	void addAtlasFolder(const String& folder);
 	ImageData* getImage(const String& fileName) { return m_images[fileName].get(); }
 
+	// Uploads on first use, which must happen on the GL thread.
+	// Other threads only get textures that were already uploaded.
 	Texture2D getTexture(const String& imageFile);
 
+	// Uploads every loaded image that is not already a material map, so other
+	// threads can use getTexture. Call after uploadMaterials.
+	void uploadTextures();
+
+	// Packs the maps into the material library, cached by the color file.
+	// Same GL thread rule as getTexture. normal and specular may be empty.
+	Material getMaterial(const String& color, const String& normal, const String& specular);
+
+	// Builds a material for every loaded "<folder>/color.tga" with the normal.tga and
+	// specular.tga next to it (the car skin layout), so other threads can use getMaterial
+	void uploadMaterials();
+
 private:
 	int getFile(const String& fileName);
 
+	void buildAtlas();
+	void buildMipChains();
+	Texture2D getAtlasPage(u32 page);
+
 	Vec<Asset> m_assetQueue;
 	UMap<String, UPtr<ImageData>> m_images;
 
 	UMap<String, Texture2D> m_textures;
 
+	Vec<String> m_atlasFolders;
+	TextureAtlas m_atlas;
+	Vec<Texture2D> m_atlasPages;
+
+	// Built by load() on the thread pool, dropped once uploaded
+	UMap<String, CompressedImage> m_mipChains;
+	Vec<CompressedImage> m_atlasMipChains;
+
+	MaterialLibrary m_materialLibrary;
+	UMap<String, Material> m_materials;
+
 	ZIPFile m_zipFile;
+	std::thread::id m_glThread;
 };
 
 #endif // ASSET_MANAGER_H
\ No newline at end of file
@@ -24,6 +24,10 @@ public:
 		return val;
 	}
 
+	void skip(size_t len) { m_data += len; }
+
+	u8* position() { return m_data; }
+
 private:
 	u8 *m_data;
 };
@@ -35,16 +39,14 @@ public:
 
 	template <typename T = u8>
 	void write(T data) {
-		size_t len = sizeof(data);
-		if (len > 1) {
-			u8* bytes = new u8[len];
-			std::memcpy(bytes, &data, len);
-			m_data.insert(m_data.end(), std::begin(bytes), std::end(bytes));
-
-			delete[] bytes;
-		} else {
-			m_data.push_back(data);
-		}
+		const u8* bytes = reinterpret_cast<const u8*>(&data);
+		m_data.insert(m_data.end(), bytes, bytes + sizeof(T));
+	}
+
+	// Overwrites bytes already written, e.g. a length reserved before its section
+	template <typename T>
+	void writeAt(size_t offset, T data) {
+		std::memcpy(m_data.data() + offset, &data, sizeof(T));
 	}
 
 	template <typename... Ts>
@@ -55,6 +57,10 @@ public:
 	u8* data() { return m_data.data(); }
 	size_t dataSize() const { return m_data.size(); }
 
+	// Keeps the capacity, so a reused writer stops allocating once warmed up
+	void clear() { m_data.clear(); }
+	void reserve(size_t size) { m_data.reserve(size); }
+
 private:
 	Vec<u8> m_data;
 };
@@ -17,6 +17,7 @@
 */
 
 #include <Box2D/Common/b2BlockAllocator.h>
+#include <Box2D/Common/b2Math.h>
 #include <limits.h>
 #include <string.h>
 #include <stddef.h>
@@ -52,9 +53,14 @@ struct b2Block
 	b2Block* next;
 };
 
-b2BlockAllocator::b2BlockAllocator()
+b2BlockAllocator::b2BlockAllocator(int32 chunkSize)
 {
 	b2Assert(b2_blockSizes < UCHAR_MAX);
+	b2Assert(chunkSize >= b2_maxBlockSize);
+
+	m_chunkSize = chunkSize;
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_stats.chunkSize = chunkSize;
 
 	m_chunkSpace = b2_chunkArrayIncrement;
 	m_chunkCount = 0;
@@ -103,12 +109,17 @@ void* b2BlockAllocator::Allocate(int32 size)
 
 	if (size > b2_maxBlockSize)
 	{
+		++m_stats.liveMallocs;
+		m_stats.liveMallocBytes += size;
 		return b2Alloc(size);
 	}
 
 	int32 index = s_blockSizeLookup[size];
 	b2Assert(0 <= index && index < b2_blockSizes);
 
+	m_stats.bytesInUse += s_blockSizes[index];
+	m_stats.maxBytesInUse = b2Max(m_stats.maxBytesInUse, m_stats.bytesInUse);
+
 	if (m_freeLists[index])
 	{
 		b2Block* block = m_freeLists[index];
@@ -128,14 +139,14 @@ void* b2BlockAllocator::Allocate(int32 size)
 		}
 
 		b2Chunk* chunk = m_chunks + m_chunkCount;
-		chunk->blocks = (b2Block*)b2Alloc(b2_chunkSize);
+		chunk->blocks = (b2Block*)b2Alloc(m_chunkSize);
 #if defined(_DEBUG)
-		memset(chunk->blocks, 0xcd, b2_chunkSize);
+		memset(chunk->blocks, 0xcd, m_chunkSize);
 #endif
 		int32 blockSize = s_blockSizes[index];
 		chunk->blockSize = blockSize;
-		int32 blockCount = b2_chunkSize / blockSize;
-		b2Assert(blockCount * blockSize <= b2_chunkSize);
+		int32 blockCount = m_chunkSize / blockSize;
+		b2Assert(blockCount * blockSize <= m_chunkSize);
 		for (int32 i = 0; i < blockCount - 1; ++i)
 		{
 			b2Block* block = (b2Block*)((int8*)chunk->blocks + blockSize * i);
@@ -147,6 +158,7 @@ void* b2BlockAllocator::Allocate(int32 size)
 
 		m_freeLists[index] = chunk->blocks->next;
 		++m_chunkCount;
+		m_stats.chunkCount = m_chunkCount;
 
 		return chunk->blocks;
 	}
@@ -163,6 +175,8 @@ void b2BlockAllocator::Free(void* p, int32 size)
 
 	if (size > b2_maxBlockSize)
 	{
+		--m_stats.liveMallocs;
+		m_stats.liveMallocBytes -= size;
 		b2Free(p);
 		return;
 	}
@@ -170,6 +184,8 @@ void b2BlockAllocator::Free(void* p, int32 size)
 	int32 index = s_blockSizeLookup[size];
 	b2Assert(0 <= index && index < b2_blockSizes);
 
+	m_stats.bytesInUse -= s_blockSizes[index];
+
 #ifdef _DEBUG
 	// Verify the memory address and size is valid.
 	int32 blockSize = s_blockSizes[index];
@@ -180,11 +196,11 @@ void b2BlockAllocator::Free(void* p, int32 size)
 		if (chunk->blockSize != blockSize)
 		{
 			b2Assert(	(int8*)p + blockSize <= (int8*)chunk->blocks ||
-						(int8*)chunk->blocks + b2_chunkSize <= (int8*)p);
+						(int8*)chunk->blocks + m_chunkSize <= (int8*)p);
 		}
 		else
 		{
-			if ((int8*)chunk->blocks <= (int8*)p && (int8*)p + blockSize <= (int8*)chunk->blocks + b2_chunkSize)
+			if ((int8*)chunk->blocks <= (int8*)p && (int8*)p + blockSize <= (int8*)chunk->blocks + m_chunkSize)
 			{
 				found = true;
 			}
@@ -212,4 +228,7 @@ void b2BlockAllocator::Clear()
 	memset(m_chunks, 0, m_chunkSpace * sizeof(b2Chunk));
 
 	memset(m_freeLists, 0, sizeof(m_freeLists));
+
+	m_stats.chunkCount = 0;
+	m_stats.bytesInUse = 0;
 }
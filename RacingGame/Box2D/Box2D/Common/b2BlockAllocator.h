@@ -29,13 +29,25 @@ const int32 b2_chunkArrayIncrement = 128;
 struct b2Block;
 struct b2Chunk;
 
+/// Usage counters of a block allocator.
+struct b2BlockAllocatorStats
+{
+	int32 chunkSize;		///< bytes per chunk
+	int32 chunkCount;		///< chunks currently owned
+	int32 bytesInUse;		///< bytes handed out from chunks, rounded up to the block size
+	int32 maxBytesInUse;	///< high-water mark of bytesInUse
+	int32 liveMallocs;		///< live allocations larger than b2_maxBlockSize that went to b2Alloc
+	int32 liveMallocBytes;	///< bytes currently held by those allocations
+};
+
 /// This is a small object allocator used for allocating small
 /// objects that persist for more than one time step.
 /// See: http://www.codeproject.com/useritems/Small_Block_Allocator.asp
 class b2BlockAllocator
 {
 public:
-	b2BlockAllocator();
+	/// @param chunkSize the size of each chunk carved into blocks, at least b2_maxBlockSize.
+	explicit b2BlockAllocator(int32 chunkSize = b2_chunkSize);
 	~b2BlockAllocator();
 
 	/// Allocate memory. This will use b2Alloc if the size is larger than b2_maxBlockSize.
@@ -46,8 +58,14 @@ public:
 
 	void Clear();
 
+	/// Get the usage counters.
+	const b2BlockAllocatorStats& GetStats() const { return m_stats; }
+
 private:
 
+	int32 m_chunkSize;
+	b2BlockAllocatorStats m_stats;
+
 	b2Chunk* m_chunks;
 	int32 m_chunkCount;
 	int32 m_chunkSpace;
@@ -19,9 +19,15 @@
 #include <Box2D/Common/b2StackAllocator.h>
 #include <Box2D/Common/b2Math.h>
 
-b2StackAllocator::b2StackAllocator()
+b2StackAllocator::b2StackAllocator(int32 stackSize)
 {
+	b2Assert(stackSize > 0);
+	m_stackSize = stackSize;
+	m_data = (char*)b2Alloc(stackSize);
 	m_index = 0;
+	m_maxIndex = 0;
+	m_mallocCount = 0;
+	m_mallocBytes = 0;
 	m_allocation = 0;
 	m_maxAllocation = 0;
 	m_entryCount = 0;
@@ -31,6 +37,7 @@ b2StackAllocator::~b2StackAllocator()
 {
 	b2Assert(m_index == 0);
 	b2Assert(m_entryCount == 0);
+	b2Free(m_data);
 }
 
 void* b2StackAllocator::Allocate(int32 size)
@@ -39,16 +46,19 @@ void* b2StackAllocator::Allocate(int32 size)
 
 	b2StackEntry* entry = m_entries + m_entryCount;
 	entry->size = size;
-	if (m_index + size > b2_stackSize)
+	if (m_index + size > m_stackSize)
 	{
 		entry->data = (char*)b2Alloc(size);
 		entry->usedMalloc = true;
+		++m_mallocCount;
+		m_mallocBytes += size;
 	}
 	else
 	{
 		entry->data = m_data + m_index;
 		entry->usedMalloc = false;
 		m_index += size;
+		m_maxIndex = b2Max(m_maxIndex, m_index);
 	}
 
 	m_allocation += size;
@@ -81,3 +91,14 @@ int32 b2StackAllocator::GetMaxAllocation() const
 {
 	return m_maxAllocation;
 }
+
+b2StackAllocatorStats b2StackAllocator::GetStats() const
+{
+	b2StackAllocatorStats stats;
+	stats.stackSize = m_stackSize;
+	stats.maxAllocation = m_maxAllocation;
+	stats.maxStackUsage = m_maxIndex;
+	stats.mallocCount = m_mallocCount;
+	stats.mallocBytes = m_mallocBytes;
+	return stats;
+}
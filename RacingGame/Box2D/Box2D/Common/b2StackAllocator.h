@@ -31,13 +31,25 @@ struct b2StackEntry
 	bool usedMalloc;
 };
 
+/// Usage counters of a stack allocator.
+struct b2StackAllocatorStats
+{
+	int32 stackSize;		///< bytes reserved for the stack
+	int32 maxAllocation;	///< high-water mark of live bytes, including fallbacks
+	int32 maxStackUsage;	///< high-water mark of bytes served from the stack itself
+	int32 mallocCount;		///< total allocations that did not fit and went to b2Alloc
+	int32 mallocBytes;		///< total bytes of those allocations
+};
+
 // This is a stack allocator used for fast per step allocations.
 // You must nest allocate/free pairs. The code will assert
 // if you try to interleave multiple allocate/free pairs.
 class b2StackAllocator
 {
 public:
-	b2StackAllocator();
+	/// @param stackSize the number of bytes reserved up front. Larger
+	/// allocations still succeed but fall back to b2Alloc and are counted.
+	explicit b2StackAllocator(int32 stackSize = b2_stackSize);
 	~b2StackAllocator();
 
 	void* Allocate(int32 size);
@@ -45,10 +57,17 @@ public:
 
 	int32 GetMaxAllocation() const;
 
+	/// Get the usage counters.
+	b2StackAllocatorStats GetStats() const;
+
 private:
 
-	char m_data[b2_stackSize];
+	char* m_data;
+	int32 m_stackSize;
 	int32 m_index;
+	int32 m_maxIndex;
+	int32 m_mallocCount;
+	int32 m_mallocBytes;
 
 	int32 m_allocation;
 	int32 m_maxAllocation;
@@ -194,6 +194,15 @@ public:
 	/// @return the angular velocity in radians/second.
 	float32 GetAngularVelocity() const;
 
+	/// Get the force and torque accumulated for the next time step.
+	/// They are cleared after each step (see b2World::SetAutoClearForces).
+	const b2Vec2& GetForce() const;
+	float32 GetTorque() const;
+
+	/// Replace the accumulated force and torque, e.g. when restoring a saved state.
+	/// This does not wake up the body.
+	void SetForce(const b2Vec2& force, float32 torque);
+
 	/// Apply a force at a world point. If the force is not
 	/// applied at the center of mass, it will generate a torque and
 	/// affect the angular velocity. This wakes up the body.
@@ -536,6 +545,22 @@ inline float32 b2Body::GetAngularVelocity() const
 	return m_angularVelocity;
 }
 
+inline const b2Vec2& b2Body::GetForce() const
+{
+	return m_force;
+}
+
+inline float32 b2Body::GetTorque() const
+{
+	return m_torque;
+}
+
+inline void b2Body::SetForce(const b2Vec2& force, float32 torque)
+{
+	m_force = force;
+	m_torque = torque;
+}
+
 inline float32 b2Body::GetMass() const
 {
 	return m_mass;
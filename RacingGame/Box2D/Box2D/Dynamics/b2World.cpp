@@ -34,7 +34,9 @@
 #include <Box2D/Common/b2Timer.h>
 #include <new>
 
-b2World::b2World(const b2Vec2& gravity)
+b2World::b2World(const b2Vec2& gravity, const b2WorldAllocatorDef& allocatorDef)
+	: m_blockAllocator(allocatorDef.chunkSize)
+	, m_stackAllocator(allocatorDef.stackSize)
 {
 	m_destructionListener = NULL;
 	g_debugDraw = NULL;
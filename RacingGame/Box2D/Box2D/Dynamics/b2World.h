@@ -35,6 +35,30 @@ class b2Draw;
 class b2Fixture;
 class b2Joint;
 
+/// Sizes of the memory pools owned by a world.
+struct b2WorldAllocatorDef
+{
+	/// The constructor sets the stock Box2D sizes.
+	b2WorldAllocatorDef()
+	{
+		chunkSize = b2_chunkSize;
+		stackSize = b2_stackSize;
+	}
+
+	/// Bytes per block allocator chunk. Must be at least b2_maxBlockSize.
+	int32 chunkSize;
+
+	/// Bytes reserved for per step allocations.
+	int32 stackSize;
+};
+
+/// Memory counters of the pools owned by a world.
+struct b2AllocatorStats
+{
+	b2BlockAllocatorStats block;
+	b2StackAllocatorStats stack;
+};
+
 /// The world class manages all physics entities, dynamic simulation,
 /// and asynchronous queries. The world also contains efficient memory
 /// management facilities.
@@ -43,7 +67,8 @@ class b2World
 public:
 	/// Construct a world object.
 	/// @param gravity the world gravity vector.
-	b2World(const b2Vec2& gravity);
+	/// @param allocatorDef the sizes of the world memory pools.
+	b2World(const b2Vec2& gravity, const b2WorldAllocatorDef& allocatorDef = b2WorldAllocatorDef());
 
 	/// Destruct the world. All physics entities are destroyed and all heap memory is released.
 	~b2World();
@@ -205,6 +230,9 @@ public:
 	/// Get the current profile.
 	const b2Profile& GetProfile() const;
 
+	/// Get the memory counters, including high-water marks and b2Alloc fallbacks.
+	b2AllocatorStats GetAllocatorStats() const;
+
 	/// Dump the world into the log file.
 	/// @warning this should be called outside of a time step.
 	void Dump();
@@ -351,4 +379,12 @@ inline const b2Profile& b2World::GetProfile() const
 	return m_profile;
 }
 
+inline b2AllocatorStats b2World::GetAllocatorStats() const
+{
+	b2AllocatorStats stats;
+	stats.block = m_blockAllocator.GetStats();
+	stats.stack = m_stackAllocator.GetStats();
+	return stats;
+}
+
 #endif
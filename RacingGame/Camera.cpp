@@ -13,10 +13,15 @@ void Camera::render(RenderContext *ctx) {
 	auto&& win = Engine::get()->window();
 
 	float asp = float(win->width()) / float(win->height());
-	float z = glm::clamp(m_zoom, 1.0f, 2.0f) * 4.0f;
+	float z = glm::clamp(renderState()->params.x, 1.0f, 2.0f) * 4.0f;
 
 	ctx->projection(glm::perspective(glm::radians(50.0f), asp, 0.01f, 1000.0f));
-	ctx->view(glm::translate(glm::mat4(1.0f), glm::vec3(-m_position.x, -m_position.y, -z)));
+	glm::vec3 pos = renderPosition(ctx->alpha());
+	ctx->view(glm::translate(glm::mat4(1.0f), glm::vec3(-pos.x, -pos.y, -z)));
+}
+
+void Camera::onSnapshot(ObjectRenderState& state) const {
+	state.params.x = m_zoom;
 }
 
 void Camera::update(float delta) {
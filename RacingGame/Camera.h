@@ -10,6 +10,9 @@ public:
 
 	void render(RenderContext *context) override;
 	void update(float delta) override;
+	void onSnapshot(ObjectRenderState& state) const override;
+	// Sets the view and projection the other objects are culled with
+	bool parallelRender() const override { return false; }
 
 	float smoothing() const { return m_smoothing; }
 	void smoothing(float s) { m_smoothing = s; }
@@ -1,6 +1,7 @@
 #include "Car.h"
 #include "Logger.h"
 #include "Engine.h"
+#include "Scene.h"
 
 static u32 clampListPos(i32 pos, u32 max) {
 	if (pos < 0) {
@@ -14,9 +15,7 @@ static u32 clampListPos(i32 pos, u32 max) {
 	return u32(pos);
 }
 
-static void displaySpline(i32 pos, const Vec<Spline>& splines) {
-	Spline spn = splines[pos];
-
+static void displaySpline(const Spline& spn, DebugCommandBuffer& out) {
 	glm::vec2 last = spn.p1;
 
 	const glm::vec4 col = glm::vec4(1.0f);
@@ -25,11 +24,17 @@ static void displaySpline(i32 pos, const Vec<Spline>& splines) {
 	for (u32 i = 1; i <= loops; i++) {
 		float t = float(i) / float(loops);
 		glm::vec2 pos = spn.get(t);
-		DebugDraw::get().line(glm::vec3(last, 0.0f), glm::vec3(pos, 0.0f), col);
+		out.line(glm::vec3(last, 0.0f), glm::vec3(pos, 0.0f), col);
 		last = pos;
 	}
 }
 
+CarBehavior::~CarBehavior() {
+	if (m_waypointDebug != 0) {
+		DebugDraw::get().release(m_waypointDebug);
+	}
+}
+
 void CarBehavior::onCreate() {
 	Car* own = dynamic_cast<Car*>(owner());
 
@@ -39,7 +44,16 @@ void CarBehavior::onCreate() {
 	acceleration = 0.0f;
 	currentWaypoint = 0;
 
-	offset = (Utils::random() * 2.0f - 1.0f) * 1.5f;
+	offset = (own->scene()->random().nextFloat() * 2.0f - 1.0f) * 1.5f;
+
+	// Drawn from the scene RNG so a restarted scene looks the same as well
+	Random& rng = own->scene()->random();
+	own->m_tint = glm::vec4(
+		std::min(rng.nextFloat() + 0.2f, 1.0f),
+		std::min(rng.nextFloat() + 0.2f, 1.0f),
+		std::min(rng.nextFloat() + 0.2f, 1.0f),
+		1.0f
+	);
 }
 
 void CarBehavior::onDestroy() {}
@@ -81,20 +95,9 @@ void CarBehavior::onUpdate(float delta) {
 	own->applyForce(relativeForce);
 
 	if (!waypoints.empty()) {
-		// Draw waypoints
-		const glm::vec4 white(1.0f, 1.0f, 1.0f, 1.0f);
-		const glm::vec4 yel(1.0f, 1.0f, 0.0f, 1.0f);
 		const glm::vec4 blu(0.0f, 0.0f, 1.0f, 1.0f);
 		const glm::vec4 red(1.0f, 0.0f, 0.0f, 1.0f);
 
-		for (u32 i = 0; i < waypoints.size(); i++) {
-			displaySpline(i, waypoints);
-			DebugDraw::get().dot(glm::vec3(waypoints[i].p0, 0.0f), yel, 0.2f);
-			DebugDraw::get().dot(glm::vec3(waypoints[i].p1, 0.0f), yel, 0.2f);
-			DebugDraw::get().dot(glm::vec3(waypoints[i].p2, 0.0f), yel, 0.2f);
-			DebugDraw::get().dot(glm::vec3(waypoints[i].p3, 0.0f), yel, 0.2f);
-		}
-
 		u32 splineID = u32(trackProgress);
 		Spline spn = waypoints[splineID];
 		float splineT = trackProgress - splineID;
@@ -106,7 +109,7 @@ void CarBehavior::onUpdate(float delta) {
 
 		currentGuidePosition += inoutOffset;
 
-		DebugDraw::get().dot(glm::vec3(currentGuidePosition, 0.0f), red, 0.4f);
+		DebugDraw::get().dot(glm::vec3(currentGuidePosition, 0.0f), red, 0.4f, DebugAI);
 
 		glm::vec2 vec = currentGuidePosition - glm::vec2(own->position());
 		float dist = glm::length(vec);
@@ -120,7 +123,7 @@ void CarBehavior::onUpdate(float delta) {
 
 		waypointSide = glm::dot(own->right(), glm::normalize(vec));
 
-		DebugDraw::get().line(own->position(), own->position() + glm::vec3(glm::normalize(vec), 0.0f), blu);
+		DebugDraw::get().line(own->position(), own->position() + glm::vec3(glm::normalize(vec), 0.0f), blu, DebugAI);
 	}
 
 	acceleration = 0.0f;
@@ -129,6 +132,128 @@ void CarBehavior::onUpdate(float delta) {
 
 }
 
+void CarBehavior::onSave(BinWriter& out) {
+	out.writeAll(
+		acceleration, steering, braking,
+		currentGuidePosition, currentWaypoint,
+		trackProgress, waypointSide, offset,
+		m_onRails, m_railsSpeed, m_railsDelta, m_railsTick
+	);
+}
+
+void CarBehavior::onRestore(BinReader& in) {
+	acceleration = in.read<float>();
+	steering = in.read<float>();
+	braking = in.read<float>();
+	currentGuidePosition = in.read<glm::vec2>();
+	currentWaypoint = in.read<u32>();
+	trackProgress = in.read<float>();
+	waypointSide = in.read<float>();
+	offset = in.read<float>();
+	m_onRails = in.read<bool>();
+	m_railsSpeed = in.read<float>();
+	m_railsDelta = in.read<float>();
+	m_railsTick = in.read<u32>();
+}
+
+bool CarBehavior::updateLOD(float delta) {
+	Car* own = dynamic_cast<Car*>(owner());
+	GameObject* focus = own->scene()->lodFocus();
+	if (focus == nullptr || waypoints.empty()) return false;
+
+	const float lodDist = own->scene()->lodDistance();
+	float dist = glm::distance(glm::vec2(own->position()), glm::vec2(focus->position()));
+
+	if (!m_onRails) {
+		// A bit of hysteresis so cars near the edge don't flip every tick
+		if (dist <= lodDist * 1.25f) return false;
+		enterRails();
+	}
+
+	m_railsDelta += delta;
+	if (++m_railsTick % LOD_RAILS_TICKS != 0) return true;
+
+	if (dist < lodDist || hasSimulatedNeighbor()) {
+		exitRails();
+		return false;
+	}
+
+	advanceRails(m_railsDelta);
+	m_railsDelta = 0.0f;
+	return true;
+}
+
+void CarBehavior::enterRails() {
+	Car* own = dynamic_cast<Car*>(owner());
+	m_railsSpeed = glm::length(own->linearVelocity());
+	m_railsDelta = 0.0f;
+	m_railsTick = own->id(); // stagger the reduced-rate updates across cars
+	m_onRails = true;
+	own->body()->SetActive(false);
+}
+
+void CarBehavior::exitRails() {
+	Car* own = dynamic_cast<Car*>(owner());
+	m_onRails = false;
+	own->body()->SetActive(true);
+	// The spline set the heading, so any spin from before the rails is stale
+	glm::vec2 vel = own->forward() * m_railsSpeed;
+	own->body()->SetLinearVelocity(b2Vec2(vel.x, vel.y));
+	own->body()->SetAngularVelocity(0.0f);
+}
+
+void CarBehavior::advanceRails(float delta) {
+	Car* own = dynamic_cast<Car*>(owner());
+
+	trackProgress = std::fmod(trackProgress + m_railsSpeed * delta, float(waypoints.size()));
+
+	u32 splineID = u32(trackProgress);
+	Spline spn = waypoints[splineID];
+	float splineT = trackProgress - splineID;
+	glm::vec2 pos = spn.get(splineT);
+	glm::vec2 dir = spn.get(splineT + 0.05f) - pos;
+	if (glm::length(dir) <= 0.0f) return;
+	dir = glm::normalize(dir);
+
+	// Same lateral offset as the guide point in onUpdate
+	pos += glm::vec2(dir.y, -dir.x) * offset;
+	currentGuidePosition = pos;
+
+	own->position(glm::vec3(pos, own->position().z));
+	own->rotation(std::atan2(dir.y, dir.x));
+}
+
+class NeighborQuery : public b2QueryCallback {
+public:
+	NeighborQuery(b2Body *self) : self(self), found(false) {}
+
+	bool ReportFixture(b2Fixture* fixture) {
+		b2Body* body = fixture->GetBody();
+		if (body != self && body->GetType() == b2_dynamicBody) {
+			found = true;
+			return false;
+		}
+		return true;
+	}
+
+	b2Body *self;
+	bool found;
+};
+
+bool CarBehavior::hasSimulatedNeighbor() {
+	Car* own = dynamic_cast<Car*>(owner());
+	glm::vec2 pos = glm::vec2(own->position());
+
+	b2AABB aabb;
+	aabb.lowerBound.Set(pos.x - LOD_NEIGHBOR_RADIUS, pos.y - LOD_NEIGHBOR_RADIUS);
+	aabb.upperBound.Set(pos.x + LOD_NEIGHBOR_RADIUS, pos.y + LOD_NEIGHBOR_RADIUS);
+
+	// Bodies on rails are inactive and not in the broad-phase, so only simulated ones are found
+	NeighborQuery query(own->body());
+	own->scene()->physicsWorld()->QueryAABB(&query, aabb);
+	return query.found;
+}
+
 void CarBehavior::setWaypoints(const Vec<glm::vec2>& points) {
 	LogAssert(points.size() >= 4, "Invalid point count for spline.");
 
@@ -141,43 +266,46 @@ void CarBehavior::setWaypoints(const Vec<glm::vec2>& points) {
 		spn.p3 = points[clampListPos(i + 2, points.size())];
 		waypoints.push_back(spn);
 	}
+
+	// The track does not change, so its overlay is built once. Cars on the same track share it.
+	const glm::vec4 yel(1.0f, 1.0f, 0.0f, 1.0f);
+	DebugCommandBuffer cmds;
+	for (auto&& spn : waypoints) {
+		displaySpline(spn, cmds);
+		cmds.dot(glm::vec3(spn.p0, 0.0f), yel, 0.2f);
+		cmds.dot(glm::vec3(spn.p1, 0.0f), yel, 0.2f);
+		cmds.dot(glm::vec3(spn.p2, 0.0f), yel, 0.2f);
+		cmds.dot(glm::vec3(spn.p3, 0.0f), yel, 0.2f);
+	}
+	if (m_waypointDebug != 0) {
+		DebugDraw::get().release(m_waypointDebug);
+	}
+	m_waypointDebug = DebugDraw::get().upload(cmds, DebugWaypoints, Utils::hash(points.data(), points.size() * sizeof(glm::vec2)));
 }
 
 Car::Car() : GameObject() {
-	m_tint = glm::vec4(
-		std::min(Utils::random() + 0.2f, 1.0f),
-		std::min(Utils::random() + 0.2f, 1.0f),
-		std::min(Utils::random() + 0.2f, 1.0f),
-		1.0f
-	);
+	m_tint = glm::vec4(1.0f);
 
 	loadSkin();
-
-	auto&& am = Engine::get()->assetManager();
-	floor = am->getTexture("textures/floor.tga"); 
 }
 
 void Car::render(RenderContext *ctx) {
-	ctx->cursor()
-		.region(glm::vec4(0, 0, 32, 32))
-		.position(glm::vec3(0.0f, 0.0f, -0.01f))
-		.rotation(0)
-		.scale(glm::vec2(32.0f));
-	ctx->submitSprite(floor, Texture2D(), Texture2D());
+	const glm::vec3 pos = renderPosition(ctx->alpha());
+	const glm::vec2 fwd = renderForward(ctx->alpha());
 
 	ctx->cursor()
 		.region(glm::vec4(0, 0, 1, 1))
 		.scale(glm::vec2(1.0f))
-		.position(worldPosition())
-		.rotation(worldRotation() + glm::radians(90.0f));
-	ctx->submitSprite(m_color, m_normal, m_specular, m_tint);
+		.position(pos)
+		.rotation(renderRotation(ctx->alpha()) + glm::radians(90.0f));
+	ctx->submitSprite(m_skin, m_tint);
 
 	const float spotFac = 0.1f;
-	glm::vec2 spotPos = forward() * spotFac + glm::vec2(worldPosition());
+	glm::vec2 spotPos = fwd * spotFac + glm::vec2(pos);
 
 	ctx->submitSpotLight(
 		glm::vec3(spotPos, 0.02f),
-		glm::vec3(forward(), -0.35f),
+		glm::vec3(fwd, -0.35f),
 		glm::vec3(1.0f, 0.9f, 0.9f),
 		1.0f,
 		6.0f,
@@ -198,9 +326,8 @@ void Car::render(RenderContext *ctx) {
 
 void Car::loadSkin(const String& name) {
 	auto&& am = Engine::get()->assetManager();
-	m_color = am->getTexture("textures/cars/" + name + "/color.tga");
-	m_normal = am->getTexture("textures/cars/" + name + "/normal.tga");
-	m_specular = am->getTexture("textures/cars/" + name + "/specular.tga");
+	const String dir = "textures/cars/" + name;
+	m_skin = am->getMaterial(dir + "/color.tga", dir + "/normal.tga", dir + "/specular.tga");
 }
 
 void CarController::onUpdate(float delta) {
@@ -226,6 +353,8 @@ void CarController::onUpdate(float delta) {
 }
 
 void CarAI::onUpdate(float delta) {
+	if (updateLOD(delta)) return;
+
 	Car* own = dynamic_cast<Car*>(owner());
 
 	if (waypointSide < 0.0f) { // LEFT
@@ -6,14 +6,27 @@
 
 #define GUIDE_MAX_DIST 2.0f
 
+// Simulation LOD: cars on rails update once every LOD_RAILS_TICKS ticks and
+// go back to full physics when another simulated body is this close.
+#define LOD_RAILS_TICKS 4
+#define LOD_NEIGHBOR_RADIUS 3.0f
+
 class CarBehavior : public Behavior {
 public:
-	CarBehavior() : trackProgress(0.0f) {}
+	CarBehavior()
+		: acceleration(0.0f), steering(0.0f), braking(0.0f),
+		currentGuidePosition(0.0f), currentWaypoint(0),
+		trackProgress(0.0f), waypointSide(0.0f), offset(0.0f)
+	{}
+	virtual ~CarBehavior();
 
 	void onCreate();
 	void onDestroy();
 	virtual void onUpdate(float delta);
 
+	void onSave(BinWriter& out) override;
+	void onRestore(BinReader& in) override;
+
 	float acceleration, steering, braking;
 
 	void setWaypoints(const Vec<glm::vec2>& points);
@@ -22,6 +35,25 @@ public:
 	glm::vec2 currentGuidePosition;
 	u32 currentWaypoint;
 	float trackProgress, waypointSide, offset;
+
+	bool onRails() const { return m_onRails; }
+
+protected:
+	// Returns true while the car is on rails and the full update must be skipped
+	bool updateLOD(float delta);
+
+private:
+	bool m_onRails{ false };
+	float m_railsSpeed{ 0.0f }, m_railsDelta{ 0.0f };
+	u32 m_railsTick{ 0 };
+
+	// Waypoint splines, uploaded once (see DebugDraw::upload)
+	u32 m_waypointDebug{ 0 };
+
+	void enterRails();
+	void exitRails();
+	void advanceRails(float delta);
+	bool hasSimulatedNeighbor();
 };
 
 class CarController : public CarBehavior {
@@ -44,21 +76,14 @@ public:
 
 	void loadSkin(const String& name = "default");
 
-	Texture2D colorTexture() const { return m_color; }
-	void colorTexture(Texture2D tex) { m_color = tex; }
-
-	Texture2D normalTexture() const { return m_normal; }
-	void normalTexture(Texture2D tex) { m_normal = tex; }
-
-	Texture2D specularTexture() const { return m_specular; }
-	void specularTexture(Texture2D tex) { m_specular = tex; }
+	Material skin() const { return m_skin; }
+	void skin(const Material& mat) { m_skin = mat; }
 
 	glm::vec4 tint() const { return m_tint; }
 	void tint(const glm::vec4& v) { m_tint = v; }
 
-	Texture2D floor;
 protected:
-	Texture2D m_color, m_normal, m_specular;
+	Material m_skin;
 	glm::vec4 m_tint;
 };
 
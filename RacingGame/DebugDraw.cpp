@@ -1,36 +1,77 @@
 #include "DebugDraw.h"
+#include "Profiler.h"
 
 UPtr<DebugDraw> DebugDraw::s_instance;
 
 DebugDraw::~DebugDraw() {
-	glDeleteBuffers(1, &m_vbo);
-	glDeleteVertexArrays(1, &m_vao);
+	for (u32 i = 0; i < DEBUG_DRAW_REGIONS; i++) {
+		if (m_fences[i] != nullptr) glDeleteSync(m_fences[i]);
+	}
+	for (auto&& p : m_persistent) {
+		if (p.vbo != 0) glDeleteBuffers(1, &p.vbo);
+	}
+	glDeleteBuffers(1, &m_ringVbo);
+	glDeleteBuffers(1, &m_shapeVbo);
+	glDeleteVertexArrays(1, &m_lineVao);
+	glDeleteVertexArrays(1, &m_shapeVao);
 }
 
 void DebugDraw::init() {
-	glGenBuffers(1, &m_vbo);
-	glGenVertexArrays(1, &m_vao);
+	// Unit outlines: circle of radius 1, then the dot (a cross inside a diamond)
+	Vec<glm::vec3> shapes;
+	const float step = glm::pi<float>() * 2.0f / DEBUG_CIRCLE_SEGMENTS;
+	for (u32 i = 0; i < DEBUG_CIRCLE_SEGMENTS; i++) {
+		shapes.push_back(glm::vec3(std::cos(step * i), std::sin(step * i), 0.0f));
+		shapes.push_back(glm::vec3(std::cos(step * (i + 1)), std::sin(step * (i + 1)), 0.0f));
+	}
+	const glm::vec3 l(-0.5f, 0.0f, 0.0f), r(0.5f, 0.0f, 0.0f), b(0.0f, -0.5f, 0.0f), t(0.0f, 0.5f, 0.0f);
+	const glm::vec3 dot[] = { l, r, b, t, l, b, r, b, l, t, r, t };
+	shapes.insert(shapes.end(), std::begin(dot), std::end(dot));
+
+	glGenBuffers(1, &m_shapeVbo);
+	glBindBuffer(GL_ARRAY_BUFFER, m_shapeVbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * shapes.size(), shapes.data(), GL_STATIC_DRAW);
 
-	glBindVertexArray(m_vao);
-	glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+	m_regionSize = 0;
+	m_region = 0;
+	for (u32 i = 0; i < DEBUG_DRAW_REGIONS; i++) {
+		m_fences[i] = nullptr;
+	}
+	glGenBuffers(1, &m_ringVbo);
+	reserveRing(256 * 1024);
+
+	glGenVertexArrays(1, &m_lineVao);
+	glBindVertexArray(m_lineVao);
+	glBindBuffer(GL_ARRAY_BUFFER, m_ringVbo);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(0, 3, GL_FLOAT, false, sizeof(DebugVertex), (void*) offsetof(DebugVertex, position));
+	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, true, sizeof(DebugVertex), (void*) offsetof(DebugVertex, color));
 
+	// Instance attributes are pointed into the ring at draw time
+	glGenVertexArrays(1, &m_shapeVao);
+	glBindVertexArray(m_shapeVao);
+	glBindBuffer(GL_ARRAY_BUFFER, m_shapeVbo);
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(0, 3, GL_FLOAT, false, 28, (void*) 0);
-	glVertexAttribPointer(1, 4, GL_FLOAT, false, 28, (void*) 12);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(0, 3, GL_FLOAT, false, sizeof(glm::vec3), (void*) 0);
+	glVertexAttribDivisor(1, 1);
+	glVertexAttribDivisor(2, 1);
 
 	glBindVertexArray(0);
 
 	const String VS = R"(#version 330 core
 layout (location = 0) in vec3 vPosition;
 layout (location = 1) in vec4 vColor;
+layout (location = 2) in vec4 vInstance; // xyz = position, w = size
 
 uniform mat4 uViewProj;
 
 out vec4 oColor;
 
 void main() {
-	gl_Position = uViewProj * vec4(vPosition, 1.0);
+	gl_Position = uViewProj * vec4(vInstance.xyz + vPosition * vInstance.w, 1.0);
 	oColor = vColor;
 })";
 	const String FS = R"(#version 330 core
@@ -47,82 +88,246 @@ void main() {
 		.link();
 }
 
+void DebugDraw::reserveRing(u32 bytes) {
+	if (bytes <= m_regionSize) return;
+
+	u32 size = 64 * 1024;
+	while (size < bytes) size *= 2;
+
+	// Orphaning the old storage, pending draws keep using it
+	for (u32 i = 0; i < DEBUG_DRAW_REGIONS; i++) {
+		if (m_fences[i] != nullptr) {
+			glDeleteSync(m_fences[i]);
+			m_fences[i] = nullptr;
+		}
+	}
+	m_regionSize = size;
+	m_region = 0;
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_ringVbo);
+	glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(m_regionSize) * DEBUG_DRAW_REGIONS, nullptr, GL_STREAM_DRAW);
+}
+
 void DebugDraw::flush(const glm::mat4& vp) {
+	ProfileZone("DebugDraw::flush");
+	syncPersistent();
+
+	m_published.acquire();
+	const DebugCommandBuffer& frame = m_published.read();
+
 	bool depthEnabled = glIsEnabled(GL_DEPTH_TEST);
 	if (depthEnabled) {
 		glDisable(GL_DEPTH_TEST);
 	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
-	if (m_vertices.size() > m_vboSize) {
-		glBufferData(GL_ARRAY_BUFFER, sizeof(float) * m_vertices.size(), m_vertices.data(), GL_DYNAMIC_DRAW);
-		m_vboSize = m_vertices.size();
-	} else {
-		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * m_vertices.size(), m_vertices.data());
-	}
-
 	m_shader.use();
 	m_shader.get("uViewProj").set(vp);
 
-	glBindVertexArray(m_vao);
-	glDrawArrays(GL_LINES, 0, m_vertices.size() / 7);
-	glBindVertexArray(0);
+	for (auto&& p : m_persistentDraws) {
+		if (enabled(p.category)) {
+			draw(p.vbo, 0, p.lines, p.circles, p.dots);
+		}
+	}
+
+	if (!frame.empty()) {
+		const u32 bytes = frame.sizeBytes();
+		reserveRing(bytes);
+
+		// Wait until the GPU has finished with the region from DEBUG_DRAW_REGIONS frames ago,
+		// then write it without synchronizing against the draws still using the others
+		GLsync& fence = m_fences[m_region];
+		if (fence != nullptr) {
+			glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+
+		const u32 base = m_region * m_regionSize;
+		glBindBuffer(GL_ARRAY_BUFFER, m_ringVbo);
+		u8* dst = static_cast<u8*>(glMapBufferRange(
+			GL_ARRAY_BUFFER, base, bytes,
+			GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT
+		));
+		if (dst != nullptr) {
+			frame.copyTo(dst);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+
+			draw(m_ringVbo, base, u32(frame.m_lines.size()), u32(frame.m_circles.size()), u32(frame.m_dots.size()));
 
-	m_vertices.clear();
+			fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			m_region = (m_region + 1) % DEBUG_DRAW_REGIONS;
+		}
+	}
+	glBindVertexArray(0);
 
 	if (depthEnabled) {
 		glEnable(GL_DEPTH_TEST);
 	}
 }
 
-void DebugDraw::line(const glm::vec3& from, const glm::vec3& to, const glm::vec4& color) {
-	m_vertices.push_back(from.x);
-	m_vertices.push_back(from.y);
-	m_vertices.push_back(from.z);
-	m_vertices.push_back(color.x);
-	m_vertices.push_back(color.y);
-	m_vertices.push_back(color.z);
-	m_vertices.push_back(color.w);
-	m_vertices.push_back(to.x);
-	m_vertices.push_back(to.y);
-	m_vertices.push_back(to.z);
-	m_vertices.push_back(color.x);
-	m_vertices.push_back(color.y);
-	m_vertices.push_back(color.z);
-	m_vertices.push_back(color.w);
+void DebugDraw::draw(GLuint vbo, u32 base, u32 lines, u32 circles, u32 dots) {
+	const u32 lineBytes = lines * sizeof(DebugVertex);
+	const u32 circleBytes = circles * sizeof(DebugShape);
+
+	if (lines > 0) {
+		glBindVertexArray(m_lineVao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glVertexAttribPointer(0, 3, GL_FLOAT, false, sizeof(DebugVertex), (void*) (base + offsetof(DebugVertex, position)));
+		glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, true, sizeof(DebugVertex), (void*) (base + offsetof(DebugVertex, color)));
+		glVertexAttrib4f(2, 0.0f, 0.0f, 0.0f, 1.0f);
+		glDrawArrays(GL_LINES, 0, lines);
+	}
+
+	glBindVertexArray(m_shapeVao);
+	drawShapes(vbo, base + lineBytes, circles, 0, DEBUG_CIRCLE_SEGMENTS * 2);
+	drawShapes(vbo, base + lineBytes + circleBytes, dots, DEBUG_CIRCLE_SEGMENTS * 2, 12);
 }
 
-void DebugDraw::dot(const glm::vec3& pos, const glm::vec4& color, float size) {
-	const float hs = size / 2.0f;
-	line(pos + glm::vec3(-hs, 0.0f, 0.0f), pos + glm::vec3(hs, 0.0f, 0.0f), color);
-	line(pos + glm::vec3(0.0f, -hs, 0.0f), pos + glm::vec3(0.0f, hs, 0.0f), color);
-	line(pos + glm::vec3(-hs, 0.0f, 0.0f), pos + glm::vec3(0.0f, -hs, 0.0f), color);
-	line(pos + glm::vec3(hs, 0.0f, 0.0f), pos + glm::vec3(0.0f, -hs, 0.0f), color);
-	line(pos + glm::vec3(-hs, 0.0f, 0.0f), pos + glm::vec3(0.0f, hs, 0.0f), color);
-	line(pos + glm::vec3(hs, 0.0f, 0.0f), pos + glm::vec3(0.0f, hs, 0.0f), color);
+void DebugDraw::drawShapes(GLuint vbo, u32 offset, u32 count, u32 first, u32 vertexCount) {
+	if (count == 0) return;
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, true, sizeof(DebugShape), (void*) (offset + offsetof(DebugShape, color)));
+	glVertexAttribPointer(2, 4, GL_FLOAT, false, sizeof(DebugShape), (void*) (offset + offsetof(DebugShape, position)));
+	glDrawArraysInstanced(GL_LINES, first, vertexCount, count);
 }
 
-static glm::vec3 getArcPoint(u32 i, float radius, float az, float start, float end, u32 segments) {
-	if (end < start) {
-		std::swap(end, start);
+void DebugDraw::syncPersistent() {
+	std::lock_guard<std::mutex> lock(m_persistentLock);
+	m_persistentDraws.clear();
+	for (auto it = m_persistent.begin(); it != m_persistent.end();) {
+		Persistent& p = *it;
+		if (p.refs == 0) {
+			if (p.vbo != 0) glDeleteBuffers(1, &p.vbo);
+			it = m_persistent.erase(it);
+			continue;
+		}
+		if (p.vbo == 0) {
+			Vec<u8> data(p.pending.sizeBytes());
+			p.pending.copyTo(data.data());
+
+			glGenBuffers(1, &p.vbo);
+			glBindBuffer(GL_ARRAY_BUFFER, p.vbo);
+			glBufferData(GL_ARRAY_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+
+			p.lines = u32(p.pending.m_lines.size());
+			p.circles = u32(p.pending.m_circles.size());
+			p.dots = u32(p.pending.m_dots.size());
+			p.pending = DebugCommandBuffer();
+		}
+		m_persistentDraws.push_back({ p.vbo, p.lines, p.circles, p.dots, p.category });
+		++it;
 	}
-	const float angleIncrement = std::abs(end - start) / segments;
-	float angle = float(i) * angleIncrement + start;
-	float cx = std::cos(angle) * radius;
-	float cy = std::sin(angle) * radius;
-	return glm::vec3(cx, cy, az);
 }
 
-void DebugDraw::circle(const glm::vec3& pos, float radius, const glm::vec4& color) {
-	const u32 segs = 32;
-	const glm::vec4 col{ color.r, color.g, color.b, color.a };
-	glm::vec3 prev = getArcPoint(0, radius, 0.0f, 0.0f, glm::pi<float>() * 2.0f, segs) + pos;
+u32 DebugDraw::upload(const DebugCommandBuffer& commands, DebugCategory category, u64 key) {
+	std::lock_guard<std::mutex> lock(m_persistentLock);
+	if (key != 0) {
+		for (auto&& p : m_persistent) {
+			if (p.key == key && p.refs > 0) {
+				p.refs++;
+				return p.handle;
+			}
+		}
+	}
+
+	Persistent p{};
+	p.handle = m_nextHandle++;
+	p.refs = 1;
+	p.key = key;
+	p.category = category;
+	p.pending = commands;
+	m_persistent.push_back(std::move(p));
+	return m_persistent.back().handle;
+}
+
+void DebugDraw::release(u32 handle) {
+	std::lock_guard<std::mutex> lock(m_persistentLock);
+	for (auto&& p : m_persistent) {
+		if (p.handle == handle && p.refs > 0) {
+			p.refs--;
+			return;
+		}
+	}
+}
+
+void DebugDraw::beginTick(float dt) {
+	m_tick.clear();
+
+	auto end = std::remove_if(m_timed.begin(), m_timed.end(), [dt](TimedCommands& t) {
+		t.remaining -= dt;
+		return t.remaining <= 0.0f;
+	});
+	m_timed.erase(end, m_timed.end());
+}
 
-	for (u32 i = 1; i <= segs; i++) {
-		glm::vec3 cvec = getArcPoint(i, radius, 0.0f, 0.0f, glm::pi<float>() * 2.0f, segs) + pos;
-		DebugDraw::get().line(prev, cvec, col);
-		prev = cvec;
+void DebugDraw::publish() {
+	// Swap instead of copying, the buffer we get back is stale and reused for the next tick
+	DebugCommandBuffer& out = m_published.write();
+	std::swap(out, m_tick);
+	for (auto&& t : m_timed) {
+		out.append(t.commands);
 	}
+	m_published.publish();
+	m_tick.clear();
+}
+
+void DebugDraw::submit(const DebugCommandBuffer& commands, float seconds, DebugCategory category) {
+	if (!enabled(category) || seconds <= 0.0f) return;
+	m_timed.push_back({ seconds, commands });
+}
+
+void DebugDraw::enabled(DebugCategory category, bool enable) {
+	if (enable) m_categories.fetch_or(1u << category, std::memory_order_relaxed);
+	else m_categories.fetch_and(~(1u << category), std::memory_order_relaxed);
+}
+
+u32 DebugDraw::packColor(const glm::vec4& color) {
+	glm::vec4 c = glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f;
+	return u32(c.r) | (u32(c.g) << 8) | (u32(c.b) << 16) | (u32(c.a) << 24);
+}
+
+void DebugDraw::line(const glm::vec3& from, const glm::vec3& to, const glm::vec4& color, DebugCategory category) {
+	if (!enabled(category)) return;
+	m_tick.line(from, to, color);
+}
+
+void DebugDraw::dot(const glm::vec3& pos, const glm::vec4& color, float size, DebugCategory category) {
+	if (!enabled(category)) return;
+	m_tick.dot(pos, color, size);
+}
+
+void DebugDraw::circle(const glm::vec3& pos, float radius, const glm::vec4& color, DebugCategory category) {
+	if (!enabled(category)) return;
+	m_tick.circle(pos, radius, color);
+}
+
+void DebugCommandBuffer::line(const glm::vec3& from, const glm::vec3& to, const glm::vec4& color) {
+	const u32 col = DebugDraw::packColor(color);
+	m_lines.push_back({ from, col });
+	m_lines.push_back({ to, col });
+}
+
+void DebugCommandBuffer::dot(const glm::vec3& pos, const glm::vec4& color, float size) {
+	m_dots.push_back({ pos, size, DebugDraw::packColor(color) });
+}
+
+void DebugCommandBuffer::circle(const glm::vec3& pos, float radius, const glm::vec4& color) {
+	m_circles.push_back({ pos, radius, DebugDraw::packColor(color) });
+}
+
+void DebugCommandBuffer::append(const DebugCommandBuffer& other) {
+	m_lines.insert(m_lines.end(), other.m_lines.begin(), other.m_lines.end());
+	m_circles.insert(m_circles.end(), other.m_circles.begin(), other.m_circles.end());
+	m_dots.insert(m_dots.end(), other.m_dots.begin(), other.m_dots.end());
+}
+
+void DebugCommandBuffer::copyTo(u8* dst) const {
+	const size_t lineBytes = m_lines.size() * sizeof(DebugVertex);
+	const size_t circleBytes = m_circles.size() * sizeof(DebugShape);
+	const size_t dotBytes = m_dots.size() * sizeof(DebugShape);
+	std::memcpy(dst, m_lines.data(), lineBytes);
+	std::memcpy(dst + lineBytes, m_circles.data(), circleBytes);
+	std::memcpy(dst + lineBytes + circleBytes, m_dots.data(), dotBytes);
 }
 
 DebugDraw& DebugDraw::get() {
@@ -137,10 +342,10 @@ void PhysicsDebugDraw::DrawPolygon(const b2Vec2* vertices, int32 vertexCount, co
 	const glm::vec4 col{ color.r, color.g, color.b, color.a };
 	for (int32 i = 1; i < vertexCount; i++) {
 		b2Vec2 vt = vertices[i];
-		DebugDraw::get().line(glm::vec3(prev.x, prev.y, 0.0f), glm::vec3(vt.x, vt.y, 0.0f), col);
+		DebugDraw::get().line(glm::vec3(prev.x, prev.y, 0.0f), glm::vec3(vt.x, vt.y, 0.0f), col, DebugPhysics);
 		prev = vt;
 	}
-	DebugDraw::get().line(glm::vec3(prev.x, prev.y, 0.0f), glm::vec3(vertices[0].x, vertices[0].y, 0.0f), col);
+	DebugDraw::get().line(glm::vec3(prev.x, prev.y, 0.0f), glm::vec3(vertices[0].x, vertices[0].y, 0.0f), col, DebugPhysics);
 }
 
 void PhysicsDebugDraw::DrawSolidPolygon(const b2Vec2* vertices, int32 vertexCount, const b2Color& color) {
@@ -148,7 +353,7 @@ void PhysicsDebugDraw::DrawSolidPolygon(const b2Vec2* vertices, int32 vertexCoun
 }
 
 void PhysicsDebugDraw::DrawCircle(const b2Vec2& center, float32 radius, const b2Color& color) {
-	DebugDraw::get().circle(glm::vec3(center.x, center.y, 0.0f), radius, glm::vec4(color.r, color.g, color.b, color.a));
+	DebugDraw::get().circle(glm::vec3(center.x, center.y, 0.0f), radius, glm::vec4(color.r, color.g, color.b, color.a), DebugPhysics);
 }
 
 void PhysicsDebugDraw::DrawSolidCircle(const b2Vec2& center, float32 radius, const b2Vec2& axis, const b2Color& color) {
@@ -156,7 +361,7 @@ void PhysicsDebugDraw::DrawSolidCircle(const b2Vec2& center, float32 radius, con
 
 void PhysicsDebugDraw::DrawSegment(const b2Vec2& p1, const b2Vec2& p2, const b2Color& color) {
 	const glm::vec4 col{ color.r, color.g, color.b, color.a };
-	DebugDraw::get().line(glm::vec3(p1.x, p1.y, 0.0f), glm::vec3(p2.x, p2.y, 0.0f), col);
+	DebugDraw::get().line(glm::vec3(p1.x, p1.y, 0.0f), glm::vec3(p2.x, p2.y, 0.0f), col, DebugPhysics);
 }
 
 void PhysicsDebugDraw::DrawTransform(const b2Transform& xf) {
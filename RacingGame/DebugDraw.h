@@ -6,29 +6,141 @@
 #include "Int.h"
 #include "Collections.h"
 #include "ShaderProgram.h"
+#include "TripleBuffer.h"
+
+#include <mutex>
 
 #include "Box2D/Box2D.h"
 
+// Overlays that can be switched off independently. Disabled categories cost
+// nothing to record, callers can also check enabled() to skip their own work.
+enum DebugCategory {
+	DebugGeneral = 0,
+	DebugPhysics,
+	DebugWaypoints,
+	DebugAI,
+	DebugCategoryCount
+};
+
+// Packed line vertex: position + RGBA8
+struct DebugVertex {
+	glm::vec3 position;
+	u32 color;
+};
+
+// Instance of the cached unit circle/dot outline
+struct DebugShape {
+	glm::vec3 position;
+	float size;
+	u32 color;
+};
+
+// A list of debug primitives. DebugDraw keeps one per tick, others can be
+// submitted for a while or uploaded once and kept on the GPU.
+class DebugCommandBuffer {
+	friend class DebugDraw;
+public:
+	void line(const glm::vec3& from, const glm::vec3& to, const glm::vec4& color);
+	void dot(const glm::vec3& pos, const glm::vec4& color, float size = 0.1f);
+	void circle(const glm::vec3& pos, float radius, const glm::vec4& color);
+
+	void append(const DebugCommandBuffer& other);
+	void clear() { m_lines.clear(); m_circles.clear(); m_dots.clear(); }
+	bool empty() const { return m_lines.empty() && m_circles.empty() && m_dots.empty(); }
+
+	u32 sizeBytes() const {
+		return u32(m_lines.size() * sizeof(DebugVertex) + (m_circles.size() + m_dots.size()) * sizeof(DebugShape));
+	}
+
+private:
+	Vec<DebugVertex> m_lines;
+	Vec<DebugShape> m_circles, m_dots;
+
+	// Lines, circles then dots, as laid out in the vertex buffers
+	void copyTo(u8* dst) const;
+};
+
+// Streaming regions in the vertex ring, each is reused once the GPU is done with it
+#define DEBUG_DRAW_REGIONS 3
+#define DEBUG_CIRCLE_SEGMENTS 32
+
 class DebugDraw {
 public:
 	~DebugDraw();
 
 	void init();
+
+	// Drops this tick's primitives and ages the timed ones. Called at the start of every tick.
+	void beginTick(float dt);
+
+	// Primitives are recorded during the simulation tick and handed to the
+	// renderer with publish(); flush() draws the latest published set.
+	void publish();
 	void flush(const glm::mat4& vp);
 
-	void line(const glm::vec3& from, const glm::vec3& to, const glm::vec4& color);
-	void dot(const glm::vec3& pos, const glm::vec4& color, float size = 0.1f);
-	void circle(const glm::vec3& pos, float radius, const glm::vec4& color);
+	// Lifetime of one tick
+	void line(const glm::vec3& from, const glm::vec3& to, const glm::vec4& color, DebugCategory category = DebugGeneral);
+	void dot(const glm::vec3& pos, const glm::vec4& color, float size = 0.1f, DebugCategory category = DebugGeneral);
+	void circle(const glm::vec3& pos, float radius, const glm::vec4& color, DebugCategory category = DebugGeneral);
+
+	// Shown for the given (simulation) time
+	void submit(const DebugCommandBuffer& commands, float seconds, DebugCategory category = DebugGeneral);
+
+	// Kept on the GPU and drawn every frame until released, for geometry that does not change.
+	// Uploads with the same non-zero key share one buffer. Can be called from any thread.
+	u32 upload(const DebugCommandBuffer& commands, DebugCategory category = DebugGeneral, u64 key = 0);
+	void release(u32 handle);
+
+	bool enabled(DebugCategory category) const { return (m_categories.load(std::memory_order_relaxed) & (1u << category)) != 0; }
+	void enabled(DebugCategory category, bool enable);
+
+	static u32 packColor(const glm::vec4& color);
 
 	static DebugDraw& get();
 
 private:
-	DebugDraw() = default;
+	DebugDraw() : m_categories(~0u), m_nextHandle(1) {}
 
 	ShaderProgram m_shader;
-	GLuint m_vbo, m_vao;
-	u32 m_vboSize;
-	Vec<float> m_vertices;
+	GLuint m_ringVbo, m_shapeVbo, m_lineVao, m_shapeVao;
+	u32 m_regionSize, m_region;
+	GLsync m_fences[DEBUG_DRAW_REGIONS];
+
+	DebugCommandBuffer m_tick;
+	TripleBuffer<DebugCommandBuffer> m_published;
+	std::atomic<u32> m_categories;
+
+	struct TimedCommands {
+		float remaining;
+		DebugCommandBuffer commands;
+	};
+	Vec<TimedCommands> m_timed;
+
+	// Created and released on any thread, the GL side is handled in flush()
+	struct Persistent {
+		u32 handle, refs;
+		u64 key;
+		DebugCategory category;
+		DebugCommandBuffer pending;
+		GLuint vbo;
+		u32 lines, circles, dots;
+	};
+	std::mutex m_persistentLock;
+	Vec<Persistent> m_persistent;
+	u32 m_nextHandle;
+
+	// What flush() draws, copied out under the lock by syncPersistent() (render thread only)
+	struct PersistentDraw {
+		GLuint vbo;
+		u32 lines, circles, dots;
+		DebugCategory category;
+	};
+	Vec<PersistentDraw> m_persistentDraws;
+
+	void reserveRing(u32 bytes);
+	void syncPersistent();
+	void draw(GLuint vbo, u32 base, u32 lines, u32 circles, u32 dots);
+	void drawShapes(GLuint vbo, u32 offset, u32 count, u32 first, u32 vertexCount);
 
 	static UPtr<DebugDraw> s_instance;
 };
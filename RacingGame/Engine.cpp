@@ -1,10 +1,15 @@
 #include "Engine.h"
 
 #include "DebugDraw.h"
+#include "Profiler.h"
+
+#include <thread>
 
 UPtr<Engine> Engine::s_instance;
 
-Engine::Engine() {}
+Engine::Engine()
+	: m_framePacing(true), m_threadedSimulation(false), m_maxFrameRate(240.0), m_lastTickTime(0)
+{}
 
 Engine* Engine::get() {
 	if (s_instance == nullptr) {
@@ -29,10 +34,11 @@ void Engine::start(Application *app, const String& title, u32 width, u32 height)
 	m_assetManager = UPtr<AssetManager>(new AssetManager());
 
 	const double timeStep = 1.0 / 60;
-	double lastTime = Utils::currentTime();
+	u64 lastTime = Utils::nanoTime();
 	double accum = 0.0;
 	u32 frames = 0;
 	double frameTime = 0.0;
+	FPSCounter fps;
 
 	Event evt;
 
@@ -45,100 +51,258 @@ void Engine::start(Application *app, const String& title, u32 width, u32 height)
 	app->onPreLoad();
 	m_assetManager->load();
 	app->onInit();
+
+	std::atomic<bool> running{ true };
+	std::thread simThread;
+	if (m_threadedSimulation) {
+		m_assetManager->uploadMaterials();
+		m_assetManager->uploadTextures();
+		m_lastTickTime = Utils::nanoTime();
+		simThread = std::thread([&]() {
+			u64 simTime = Utils::nanoTime();
+			double simAccum = 0.0;
+			while (running.load(std::memory_order_acquire)) {
+				u64 now = Utils::nanoTime();
+				simAccum += double(now - simTime) * 1e-9;
+				simTime = now;
+
+				while (simAccum >= timeStep) {
+					tick(app, float(timeStep));
+					simAccum -= timeStep;
+				}
+				Utils::sleepPrecise(timeStep - simAccum);
+			}
+		});
+	}
+
 	while (!m_window->shouldClose()) {
-		bool canRender = false;
-		double currentTime = Utils::currentTime();
-		double delta = currentTime - lastTime;
+		u64 currentTime = Utils::nanoTime();
+		double delta = double(currentTime - lastTime) * 1e-9;
 		lastTime = currentTime;
 		accum += delta;
 		frameTime += delta;
 
 		if (frameTime >= 1.0) {
 #ifdef _DEBUG
-			m_window->title(
-				Utils::concat(
-					originalTitle, " | ",
-					std::to_string(frames), "fps | ",
-					(delta * 1000.0), "ms"
-				)
+			const RenderStats& stats = m_renderContext->stats();
+			FixedString<256> newTitle;
+			newTitle.write(
+				originalTitle, " | ",
+				frames, "fps | ",
+				(fps.get() > 0.0f ? 1000.0 / fps.get() : 0.0), "ms | ",
+				stats.drawCalls, " draws, ",
+				stats.stateChanges(), " state changes, ",
+				stats.culled, " culled, ",
+				stats.uploadBytes / 1024, " KB uploaded"
 			);
+			m_window->title(newTitle.c_str());
 #endif
 			frameTime = 0.0;
 			frames = 0;
 		}
 
-		m_input.update(m_window.get());
+		{
+			ProfileZone("Input");
+			m_input.update(m_window.get());
+		}
 
-		while (accum >= timeStep) {
-			float dt = float(timeStep);
+		float alpha;
+		if (m_threadedSimulation) {
+			double sinceTick = double(Utils::nanoTime() - m_lastTickTime.load(std::memory_order_acquire)) * 1e-9;
+			alpha = float(glm::clamp(sinceTick / timeStep, 0.0, 1.0));
+		} else {
+			while (accum >= timeStep) {
+				tick(app, float(timeStep));
+				accum -= timeStep;
+			}
+			alpha = float(accum / timeStep);
+		}
 
-			app->onUpdate(dt);
-			m_sceneManager->update(dt);
+		render(app, alpha);
+		fps.tick();
+		frames++;
 
-			accum -= timeStep;
-			canRender = true;
+		if (m_framePacing && m_maxFrameRate > 0.0) {
+			ProfileZone("Idle");
+			double frameDuration = double(Utils::nanoTime() - currentTime) * 1e-9;
+			double remaining = (1.0 / m_maxFrameRate) - frameDuration;
+			if (remaining > 0.0) {
+				Utils::sleepPrecise(remaining);
+			}
 		}
+	}
 
-		if (canRender) {
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-			m_renderContext->begin();
-			m_sceneManager->render(m_renderContext.get());
-			m_renderContext->end();
+	if (simThread.joinable()) {
+		running.store(false, std::memory_order_release);
+		simThread.join();
+	}
+#if PROFILER_ENABLED
+	Profiler::get().exportTrace("trace.json");
+#endif
+	app->onExit();
+	delete app;
+}
 
-			m_renderContext->begin();
-			app->onRender(m_renderContext.get());
-			m_renderContext->end();
+void Engine::tick(Application *app, float dt) {
+	ProfileZone("Update");
+	m_input.latch();
+#ifdef _DEBUG
+	beginDeterminismTick();
+#endif
+
+	// Only the last tick's debug lines survive to the next flush
+	DebugDraw::get().beginTick(dt);
+
+	app->onUpdate(dt);
+	m_sceneManager->update(dt);
+#ifdef _DEBUG
+	endDeterminismTick();
+#endif
+
+	DebugDraw::get().publish();
+	m_lastTickTime.store(Utils::nanoTime(), std::memory_order_release);
+}
 
-			DebugDraw::get().flush(m_renderContext->projection() * m_renderContext->view());
+void Engine::render(Application *app, float alpha) {
+	ProfileZone("Render");
+	m_renderContext->alpha(alpha);
+	m_renderContext->beginFrame();
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	m_renderContext->begin();
+	m_sceneManager->render(m_renderContext.get());
+	m_renderContext->end();
+
+	m_renderContext->begin();
+	app->onRender(m_renderContext.get());
+	m_renderContext->end();
+
+	DebugDraw::get().flush(m_renderContext->projection() * m_renderContext->view());
+
+	{
+		ProfileZone("SwapBuffers");
+		m_window->swapBuffers();
+	}
+}
 
-			m_window->swapBuffers();
-			frames++;
+void Engine::checkDeterminism(u32 ticks) {
+#ifdef _DEBUG
+	m_determinism.requested = ticks;
+#endif
+}
+
+#ifdef _DEBUG
+void Engine::beginDeterminismTick() {
+	DeterminismCheck& dc = m_determinism;
+	if (dc.requested > 0) {
+		// Takes effect in this tick's scene update, so both runs start on a scene change
+		dc.phase = DeterminismCheck::Recording;
+		dc.ticks = dc.requested;
+		dc.index = 0;
+		dc.requested = 0;
+		dc.inputs.clear();
+		dc.hashes.clear();
+		m_sceneManager->restart();
+		LogInfo("Determinism check: recording ", dc.ticks, " ticks.");
+	}
+
+	if (dc.phase == DeterminismCheck::Recording) {
+		dc.inputs.push_back(m_input.frame());
+	} else if (dc.phase == DeterminismCheck::Replaying) {
+		m_input.frame(dc.inputs[dc.index]);
+	}
+}
+
+void Engine::endDeterminismTick() {
+	DeterminismCheck& dc = m_determinism;
+	if (dc.phase == DeterminismCheck::Idle) return;
+
+	Scene* scene = m_sceneManager->current();
+	u64 hash = scene != nullptr ? scene->stateHash() : 0;
+
+	if (dc.phase == DeterminismCheck::Recording) {
+		dc.hashes.push_back(hash);
+		if (++dc.index == dc.ticks) {
+			dc.phase = DeterminismCheck::Replaying;
+			dc.index = 0;
+			m_sceneManager->restart();
 		}
+		return;
+	}
+
+	if (hash != dc.hashes[dc.index]) {
+		LogError("Determinism check: world state differs at tick ", dc.index, " of ", dc.ticks, ".");
+		dc.phase = DeterminismCheck::Idle;
+	} else if (++dc.index == dc.ticks) {
+		LogInfo("Determinism check: ", dc.ticks, " ticks replayed identically.");
+		dc.phase = DeterminismCheck::Idle;
 	}
-	app->onExit();
-	delete app;
 }
+#endif
+
+Input::Frame Input::frame() const {
+	Frame f;
+	std::copy(std::begin(m_keyboard), std::end(m_keyboard), f.keyboard);
+	std::copy(std::begin(m_mouse), std::end(m_mouse), f.mouse);
+	f.mousePosition = m_mousePosition;
+	return f;
+}
+
+void Input::frame(const Frame& f) {
+	std::copy(std::begin(f.keyboard), std::end(f.keyboard), m_keyboard);
+	std::copy(std::begin(f.mouse), std::end(f.mouse), m_mouse);
+	m_mousePosition = f.mousePosition;
+}
+
+void Input::latch() {
+	std::lock_guard<std::mutex> lock(m_lock);
+	std::copy(std::begin(m_pendingKeyboard), std::end(m_pendingKeyboard), m_keyboard);
+	std::copy(std::begin(m_pendingMouse), std::end(m_pendingMouse), m_mouse);
+	m_mousePosition = m_pendingMousePosition;
 
-void Input::update(Window *win) {
 	for (u32 i = 0; i < 0xFF; i++) {
-		m_keyboard[i].press = m_keyboard[i].release = false;
+		m_pendingKeyboard[i].press = m_pendingKeyboard[i].release = false;
 	}
 
 	for (u32 i = 0; i < 3; i++) {
-		m_mouse[i].press = m_mouse[i].release = false;
+		m_pendingMouse[i].press = m_pendingMouse[i].release = false;
 	}
+}
+
+void Input::update(Window *win) {
+	std::lock_guard<std::mutex> lock(m_lock);
 
 	Event evt{};
 	while (win->popEvent(evt)) {
 		switch (evt.type) {
 			case EventType::KeyDowm:
 			{
-				m_keyboard[evt.key].press = true;
-				m_keyboard[evt.key].down = true;
+				m_pendingKeyboard[evt.key].press = true;
+				m_pendingKeyboard[evt.key].down = true;
 			} break;
 			case EventType::KeyUp:
 			{
-				m_keyboard[evt.key].release = true;
-				m_keyboard[evt.key].down = false;
+				m_pendingKeyboard[evt.key].release = true;
+				m_pendingKeyboard[evt.key].down = false;
 			} break;
 			case EventType::MouseButtonDown:
 			{
-				m_mouse[evt.mouseButton].press = true;
-				m_mouse[evt.mouseButton].down = true;
-				m_mousePosition.x = evt.mouseX;
-				m_mousePosition.y = evt.mouseY;
+				m_pendingMouse[evt.mouseButton].press = true;
+				m_pendingMouse[evt.mouseButton].down = true;
+				m_pendingMousePosition.x = evt.mouseX;
+				m_pendingMousePosition.y = evt.mouseY;
 			} break;
 			case EventType::MouseButtonUp:
 			{
-				m_mouse[evt.mouseButton].release = true;
-				m_mouse[evt.mouseButton].down = false;
-				m_mousePosition.x = evt.mouseX;
-				m_mousePosition.y = evt.mouseY;
+				m_pendingMouse[evt.mouseButton].release = true;
+				m_pendingMouse[evt.mouseButton].down = false;
+				m_pendingMousePosition.x = evt.mouseX;
+				m_pendingMousePosition.y = evt.mouseY;
 			} break;
 			case EventType::MouseMove:
 			{
-				m_mousePosition.x = evt.mouseX;
-				m_mousePosition.y = evt.mouseY;
+				m_pendingMousePosition.x = evt.mouseX;
+				m_pendingMousePosition.y = evt.mouseY;
 			} break;
 		}
 	}
@@ -8,6 +8,9 @@
 #include "Utils.h"
 #include "AssetManager.h"
 
+#include <atomic>
+#include <mutex>
+
 class Application {
 public:
 	virtual void onPreLoad() = 0;
@@ -34,13 +37,26 @@ public:
 
 	glm::vec2 mousePosition() const { return m_mousePosition; }
 
+	// State latched for one tick, for recording and replaying input
+	struct Frame {
+		State keyboard[0xFF], mouse[3];
+		glm::vec2 mousePosition;
+	};
+	Frame frame() const;
+	void frame(const Frame& f);
 
 private:
-	State m_keyboard[0xFF];
-	State m_mouse[3];
-	glm::vec2 m_mousePosition;
+	State m_keyboard[0xFF]{}, m_pendingKeyboard[0xFF]{};
+	State m_mouse[3]{}, m_pendingMouse[3]{};
+	glm::vec2 m_mousePosition, m_pendingMousePosition;
+	std::mutex m_lock;
 
+	// Window thread: collects events into the pending state
 	void update(Window *win);
+
+	// Simulation thread: exposes the pending state for the next tick.
+	// Presses and releases stay set for exactly one tick.
+	void latch();
 };
 
 class Engine {
@@ -57,14 +73,58 @@ public:
 	RenderContext* renderContext() { return m_renderContext.get(); }
 	Input& input() { return m_input; }
 
+	// Sleep until the next frame is due instead of spinning
+	bool framePacing() const { return m_framePacing; }
+	void framePacing(bool enable) { m_framePacing = enable; }
+
+	// Render rate cap used by frame pacing. Simulation always ticks at a fixed 60Hz
+	// and rendering interpolates between the last two ticks.
+	double maxFrameRate() const { return m_maxFrameRate; }
+	void maxFrameRate(double fps) { m_maxFrameRate = fps; }
+
+	// Run the simulation on its own thread. The window, GL context and onRender stay
+	// on the main thread, which draws the latest published scene snapshot.
+	// onUpdate, behaviors and scene creation then run on the simulation thread and
+	// must not make GL calls (textures and materials are uploaded up front, see AssetManager).
+	// Set before start().
+	bool threadedSimulation() const { return m_threadedSimulation; }
+	void threadedSimulation(bool enable) { m_threadedSimulation = enable; }
+
+	// Debug builds: restarts the current scene and records the input and
+	// Scene::stateHash() of the next `ticks` ticks, then restarts it again with the
+	// same seed, replays that input and logs the first tick whose hash differs.
+	// Call from onInit or onUpdate.
+	void checkDeterminism(u32 ticks);
+
 private:
 	Engine();
 
+	void tick(Application *app, float dt);
+	void render(Application *app, float alpha);
+
 	UPtr<SceneManager> m_sceneManager;
 	UPtr<AssetManager> m_assetManager;
 	UPtr<RenderContext> m_renderContext;
 	UPtr<Window> m_window;
 	Input m_input;
+	bool m_framePacing, m_threadedSimulation;
+	double m_maxFrameRate;
+
+	// Time of the last finished tick, for interpolating on the render thread
+	std::atomic<u64> m_lastTickTime;
+
+#ifdef _DEBUG
+	// Simulation thread only
+	struct DeterminismCheck {
+		enum Phase { Idle, Recording, Replaying };
+		Phase phase{ Idle };
+		u32 requested{ 0 }, ticks{ 0 }, index{ 0 };
+		Vec<Input::Frame> inputs;
+		Vec<u64> hashes;
+	} m_determinism;
+	void beginDeterminismTick();
+	void endDeterminismTick();
+#endif
 
 	static UPtr<Engine> s_instance;
 };
@@ -6,6 +6,9 @@
 void GameObject::update(float delta) {
 	if (m_dead) { return; }
 
+	m_prevPosition = m_position;
+	m_prevRotation = m_rotation;
+
 	if (m_life != -1) {
 		m_life -= delta;
 		if (m_life <= 0.0f) {
@@ -37,6 +40,11 @@ void GameObject::update(float delta) {
 		m_rotation = m_body->GetAngle();
 	}
 
+	if (m_firstTime) {
+		m_prevPosition = m_position;
+		m_prevRotation = m_rotation;
+	}
+
 	for (auto&& b : m_behaviors) {
 		if (m_firstTime) {
 			b->onCreate();
@@ -87,6 +95,49 @@ float GameObject::worldRotation() const {
 	return rot;
 }
 
+static float lerpAngle(float from, float to, float t) {
+	const float twoPi = glm::two_pi<float>();
+	float diff = std::fmod(to - from, twoPi);
+	if (diff > glm::pi<float>()) diff -= twoPi;
+	else if (diff < -glm::pi<float>()) diff += twoPi;
+	return from + diff * t;
+}
+
+glm::vec3 GameObject::renderPosition(float alpha) const {
+	if (m_renderState != nullptr) {
+		return glm::mix(m_renderState->prevPosition, m_renderState->position, alpha);
+	}
+	return blendedPosition(alpha);
+}
+
+float GameObject::renderRotation(float alpha) const {
+	if (m_renderState != nullptr) {
+		return lerpAngle(m_renderState->prevRotation, m_renderState->rotation, alpha);
+	}
+	return blendedRotation(alpha);
+}
+
+glm::vec3 GameObject::blendedPosition(float alpha) const {
+	glm::vec3 pos = glm::mix(m_prevPosition, m_position, alpha);
+	if (m_parent == nullptr) {
+		return pos;
+	}
+	return glm::rotateZ(pos, m_parent->blendedRotation(alpha)) + m_parent->blendedPosition(alpha);
+}
+
+float GameObject::blendedRotation(float alpha) const {
+	float rot = lerpAngle(m_prevRotation, m_rotation, alpha);
+	if (m_parent != nullptr) {
+		rot += m_parent->blendedRotation(alpha);
+	}
+	return rot;
+}
+
+glm::vec2 GameObject::renderForward(float alpha) const {
+	float rot = renderRotation(alpha);
+	return glm::vec2(std::cos(rot), std::sin(rot));
+}
+
 glm::vec2 GameObject::forward() const {
 	float rot = worldRotation();
 	return glm::vec2(std::cos(rot), std::sin(rot));
@@ -8,6 +8,7 @@
 #include "RenderContext.h"
 #include "Window.h"
 #include "Logger.h"
+#include "BinIO.h"
 
 #include "Box2D/Box2D.h"
 
@@ -20,11 +21,17 @@ struct Collision {
 class Behavior {
 	friend class GameObject;
 public:
+	virtual ~Behavior() = default;
+
 	virtual void onCreate() = 0;
 	virtual void onDestroy() = 0;
 	virtual void onUpdate(float delta) = 0;
 
-	virtual void onCollide(Collision collision) { }
+	virtual void onCollide(const Collision& collision) { }
+
+	// Simulation state for Scene snapshots. Both must read/write the same fields in the same order.
+	virtual void onSave(BinWriter& out) { }
+	virtual void onRestore(BinReader& in) { }
 	
 	GameObject* owner() { return m_owner; }
 
@@ -32,6 +39,15 @@ private:
 	GameObject *m_owner;
 };
 
+// World transform of an object for the last two ticks plus anything else its
+// render() needs, copied on the simulation thread (see Scene::publishSnapshot)
+struct ObjectRenderState {
+	GameObject *object;
+	glm::vec3 position, prevPosition;
+	float rotation, prevRotation;
+	glm::vec4 params;
+};
+
 class Scene;
 class GameObject {
 	friend class Scene;
@@ -43,13 +59,23 @@ public:
 
 	GameObject() 
 		: m_firstTime(true), m_scale(glm::vec2(1.0f)),
-		m_rotation(0.0f), m_dead(false), m_life(-1),
-		m_body(nullptr)
+		m_rotation(0.0f), m_prevRotation(0.0f), m_dead(false), m_life(-1),
+		m_parent(nullptr), m_body(nullptr), m_id(0), m_renderState(nullptr)
 	{}
 
 	virtual void render(RenderContext *context) {}
 	virtual void update(float delta);
 
+	// render() runs in a pool job alongside other objects unless this is false.
+	// Objects that set frame wide state (projection, view...) must return false,
+	// they render first on the render thread.
+	virtual bool parallelRender() const { return true; }
+
+	// Copies simulation state that render() reads into the tick's snapshot.
+	// render() may run on another thread, so it must only read the snapshot
+	// (renderState()) and data that does not change after creation.
+	virtual void onSnapshot(ObjectRenderState& state) const { }
+
 	void kill(float life = 0.0f) { m_life = life; }
 
 	void addBehavior(Behavior *behavior);
@@ -69,11 +95,22 @@ public:
 	glm::vec3 worldPosition() const;
 	float worldRotation() const;
 
+	// World transform blended between the previous and the current tick, for rendering
+	glm::vec3 renderPosition(float alpha) const;
+	float renderRotation(float alpha) const;
+	glm::vec2 renderForward(float alpha) const;
+
+	// Snapshot entry being rendered, only valid inside render()
+	const ObjectRenderState* renderState() const { return m_renderState; }
+
 	glm::vec2 forward() const;
 	glm::vec2 right() const;
 
 	Scene* scene() { return m_scene; }
 
+	// Creation order within the scene, stable across runs
+	u32 id() const { return m_id; }
+
 	void tag(const String& t) { m_tag = t; }
 	String tag() const { return m_tag; }
 
@@ -104,9 +141,9 @@ public:
 	}
 
 protected:
-	glm::vec3 m_position;
+	glm::vec3 m_position, m_prevPosition;
 	glm::vec2 m_scale;
-	float m_rotation, m_life;
+	float m_rotation, m_prevRotation, m_life;
 
 	Vec<UPtr<Behavior>> m_behaviors;
 	bool m_firstTime, m_dead;
@@ -115,11 +152,18 @@ protected:
 	Scene *m_scene;
 
 	String m_tag;
+	u32 m_id;
 
 	// Physics
 	b2Body *m_body;
 
 	void createFixture(b2Shape *shape);
+
+private:
+	const ObjectRenderState *m_renderState;
+
+	glm::vec3 blendedPosition(float alpha) const;
+	float blendedRotation(float alpha) const;
 };
 
 #endif // GAME_OBJECT_H
\ No newline at end of file
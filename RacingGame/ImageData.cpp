@@ -1,7 +1,18 @@
 #include "ImageData.h"
 
 #include "Logger.h"
+#include "ThreadPool.h"
 #include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <xmmintrin.h>
+#define IMAGE_SSE2 1
+#else
+#define IMAGE_SSE2 0
+#endif
 
 ImageData::ImageData(u32 width, u32 height) {
 	m_width = width;
@@ -9,6 +20,20 @@ ImageData::ImageData(u32 width, u32 height) {
 	m_pixels.resize(width * height * 4);
 }
 
+void ImageData::blit(ImageData& src, u32 x, u32 y, u32 extrude) {
+	const i64 w = src.width(), h = src.height();
+	for (i64 dy = -i64(extrude); dy < h + i64(extrude); dy++) {
+		const i64 sy = std::clamp<i64>(dy, 0, h - 1);
+		u8* dst = &m_pixels[((y + dy) * m_width + x - extrude) * 4];
+		const u8* row = &src.m_pixels[sy * w * 4];
+
+		for (u32 i = 0; i < extrude; i++, dst += 4) std::memcpy(dst, row, 4);
+		std::memcpy(dst, row, w * 4);
+		dst += w * 4;
+		for (u32 i = 0; i < extrude; i++, dst += 4) std::memcpy(dst, row + (w - 1) * 4, 4);
+	}
+}
+
 ImageData& ImageData::from(const String& fileName) {
 	std::ifstream fs(fileName, std::ios::ate | std::ios::binary);
 	if (fs.good()) {
@@ -56,6 +81,74 @@ void ImageData::set(u32 x, u32 y, u8 r, u8 g, u8 b, u8 a) {
 	m_pixels[index + 3] = a;
 }
 
+void ImageData::fill(u8 r, u8 g, u8 b, u8 a) {
+	const u8 texel[] = { r, g, b, a };
+	for (size_t i = 0; i < m_pixels.size(); i += 4) {
+		std::memcpy(&m_pixels[i], texel, 4);
+	}
+}
+
+// 8 bit sRGB (or unorm) to linear float, and linear back to sRGB in 1/4095 steps
+struct GammaTables {
+	float toLinear[256], unorm[256];
+	u8 toSrgb[4096];
+
+	GammaTables() {
+		for (u32 i = 0; i < 256; i++) {
+			const float c = float(i) / 255.0f;
+			toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			unorm[i] = c;
+		}
+		for (u32 i = 0; i < 4096; i++) {
+			const float l = float(i) / 4095.0f;
+			const float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+			toSrgb[i] = u8(c * 255.0f + 0.5f);
+		}
+	}
+};
+static const GammaTables s_gamma;
+
+ImageData ImageData::downsample(bool srgb) {
+	ImageData half(std::max(m_width / 2, 1u), std::max(m_height / 2, 1u));
+	const float* toLinear = srgb ? s_gamma.toLinear : s_gamma.unorm;
+	const float* unorm = s_gamma.unorm;
+
+	ThreadPool::get().parallelFor(half.m_height, 16, [&](u32 begin, u32 end) {
+		for (u32 y = begin; y < end; y++) {
+			const u32 y0 = std::min(y * 2, m_height - 1), y1 = std::min(y * 2 + 1, m_height - 1);
+			for (u32 x = 0; x < half.m_width; x++) {
+				const u32 x0 = std::min(x * 2, m_width - 1), x1 = std::min(x * 2 + 1, m_width - 1);
+				const u8* src[] = {
+					&m_pixels[(y0 * m_width + x0) * 4], &m_pixels[(y0 * m_width + x1) * 4],
+					&m_pixels[(y1 * m_width + x0) * 4], &m_pixels[(y1 * m_width + x1) * 4]
+				};
+
+				// One texel (RGBA) per register
+				alignas(16) float avg[4];
+#if IMAGE_SSE2
+				__m128 sum = _mm_setzero_ps();
+				for (const u8* p : src) {
+					sum = _mm_add_ps(sum, _mm_set_ps(unorm[p[3]], toLinear[p[2]], toLinear[p[1]], toLinear[p[0]]));
+				}
+				_mm_store_ps(avg, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+				for (u32 c = 0; c < 4; c++) {
+					const float* table = c < 3 ? toLinear : unorm;
+					avg[c] = (table[src[0][c]] + table[src[1][c]] + table[src[2][c]] + table[src[3][c]]) * 0.25f;
+				}
+#endif
+
+				u8* dst = &half.m_pixels[(y * half.m_width + x) * 4];
+				for (u32 c = 0; c < 3; c++) {
+					dst[c] = srgb ? s_gamma.toSrgb[u32(avg[c] * 4095.0f + 0.5f)] : u8(avg[c] * 255.0f + 0.5f);
+				}
+				dst[3] = u8(avg[3] * 255.0f + 0.5f);
+			}
+		}
+	});
+	return half;
+}
+
 void ImageData::loadUncompressed(BinReader* rd) {
 	rd->read<u16>(); // X origin
 	rd->read<u16>(); // Y origin
@@ -15,6 +15,16 @@ public:
 	ImageData& from(u8* data);
 
 	void set(u32 x, u32 y, u8 r, u8 g, u8 b, u8 a = 0xFF);
+	void fill(u8 r, u8 g, u8 b, u8 a = 0xFF);
+
+	// Next mip level, half the size (at least 1), 2x2 box filtered in linear
+	// space. srgb is for color, data maps (normal, specular) are averaged as is.
+	// Rows are split over the thread pool.
+	ImageData downsample(bool srgb = true);
+
+	// Copies src with its top left corner at (x, y), repeating its edge
+	// pixels for extrude more pixels around it. Everything must fit.
+	void blit(ImageData& src, u32 x, u32 y, u32 extrude = 0);
 
 	u32 width() const { return m_width; }
 	u32 height() const { return m_height; }
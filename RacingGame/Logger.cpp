@@ -11,15 +11,22 @@ Logger Logger::logger = Logger(Logger::logFile);
 #endif
 
 Logger::Logger() : m_output(&std::cout) {
+	start();
 }
 
 Logger::Logger(std::ostream* output) : m_output(output) {
+	start();
 	if (m_output->bad()) {
 		LogAssert(false, "Invalid output.");
 	}
 }
 
 Logger::~Logger() {
+	m_running.store(false, std::memory_order_release);
+	if (m_writer.joinable()) {
+		m_writer.join();
+	}
+
 	m_output->flush();
 	static std::stringstream closed_flag;
 	m_output->rdbuf(closed_flag.rdbuf());
@@ -43,21 +50,131 @@ static String replaceAll(const String& in, const String& what, const String& by)
 	return str;
 }
 
-void Logger::print(LogLevel level, const char* file, const char* function, int line, const String& msg) {
+void Logger::start() {
+	m_ring = UPtr<Slot[]>(new Slot[LOG_RING_SIZE]);
+	for (u64 i = 0; i < LOG_RING_SIZE; i++) {
+		m_ring[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	m_level = LogLevel::Debug;
+	m_head = 0;
+	m_written = 0;
+	m_dropped = 0;
+	m_tail = 0;
+	m_lastTime = 0;
+	m_timeStamp[0] = '\0';
+
+	m_running = true;
+	m_writer = std::thread(&Logger::writerLoop, this);
+}
+
+void Logger::flush() {
+	if (!m_writer.joinable() || std::this_thread::get_id() == m_writer.get_id()) return;
+
+	u64 target = m_head.load(std::memory_order_acquire);
+	while (m_written.load(std::memory_order_acquire) < target) {
+		std::this_thread::yield();
+	}
+}
+
+Logger::Slot* Logger::reserve(LogLevel level, u64& pos) {
+	Slot* slot = tryReserve(pos);
+	if (slot == nullptr) {
+		if (level != LogLevel::Fatal) {
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		while ((slot = tryReserve(pos)) == nullptr) {
+			std::this_thread::yield();
+		}
+	}
+	return slot;
+}
+
+Logger::Slot* Logger::tryReserve(u64& pos) {
+	// Bounded MPSC queue, each slot's sequence tells whose turn it is
+	pos = m_head.load(std::memory_order_relaxed);
+	while (true) {
+		Slot* slot = &m_ring[pos & (LOG_RING_SIZE - 1)];
+		i64 diff = i64(slot->sequence.load(std::memory_order_acquire)) - i64(pos);
+		if (diff == 0) {
+			if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return slot;
+		} else if (diff < 0) {
+			return nullptr; // Full
+		} else {
+			pos = m_head.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+void Logger::commit(Slot* slot, u64 pos) {
+	LogLevel level = slot->record.level;
+	slot->sequence.store(pos + 1, std::memory_order_release);
+
+	// Make sure it is out before we break into the debugger
+	if (level == LogLevel::Fatal) {
+		flush();
+	}
+}
+
+void Logger::writerLoop() {
+	const u32 batchSize = 256;
+	u64 reportedDrops = 0;
+	while (true) {
+		// Read before draining, so everything printed before shutdown still gets written
+		bool running = m_running.load(std::memory_order_acquire);
+
+		u32 count = 0;
+		while (count < batchSize) {
+			Slot& slot = m_ring[m_tail & (LOG_RING_SIZE - 1)];
+			if (slot.sequence.load(std::memory_order_acquire) != m_tail + 1) break;
+
+			write(slot.record);
+
+			slot.sequence.store(m_tail + LOG_RING_SIZE, std::memory_order_release);
+			m_tail++;
+			count++;
+		}
+
+		u64 drops = m_dropped.load(std::memory_order_relaxed);
+		if (drops != reportedDrops) {
+			(*m_output) << "[" << m_timeStamp << "] [WARN] Log ring full, dropped " << (drops - reportedDrops) << " records.\n";
+			reportedDrops = drops;
+			count++;
+		}
+
+		if (count > 0) {
+			m_output->flush();
+			m_written.store(m_tail, std::memory_order_release);
+		} else if (!running) {
+			break;
+		} else {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+}
+
+void Logger::write(const LogRecord& rec) {
 	// [12/12/2017 23:45] => [ERROR] [func@33] Test error!
-	String prefx = "[" + Utils::currentDateTime() + "] ";
-	String filen = file;
-	std::replace(filen.begin(), filen.end(), '\\', '/');
-	filen = filen.substr(filen.find_last_of('/') + 1);
+	if (rec.time != m_lastTime) {
+		struct tm tstruct;
+		localtime_s(&tstruct, &rec.time);
+		strftime(m_timeStamp, sizeof(m_timeStamp), "%m/%d/%Y %X", &tstruct);
+		m_lastTime = rec.time;
+	}
+
+	const char* filen = rec.file;
+	for (const char* c = rec.file; *c; c++) {
+		if (*c == '/' || *c == '\\') filen = c + 1;
+	}
 
 #ifdef _DEBUG
 	(*m_output) << termcolor::green << termcolor::dark;
 #endif
 
-	(*m_output) << prefx;
+	(*m_output) << "[" << m_timeStamp << "] ";
 
 #ifdef _DEBUG
-	switch (level) {
+	switch (rec.level) {
 		case LogLevel::Debug: (*m_output) << termcolor::cyan; break;
 		case LogLevel::Info: (*m_output) << termcolor::blue; break;
 		case LogLevel::Warning: (*m_output) << termcolor::yellow; break;
@@ -65,7 +182,7 @@ void Logger::print(LogLevel level, const char* file, const char* function, int l
 		case LogLevel::Fatal: (*m_output) << termcolor::magenta; break;
 	}
 #endif
-	switch (level) {
+	switch (rec.level) {
 		case LogLevel::Debug: (*m_output) << "[DBUG]"; break;
 		case LogLevel::Info: (*m_output) << "[INFO]"; break;
 		case LogLevel::Warning: (*m_output) << "[WARN]"; break;
@@ -77,5 +194,30 @@ void Logger::print(LogLevel level, const char* file, const char* function, int l
 	(*m_output) << termcolor::reset;
 #endif
 
-	(*m_output) << " [" << filen << "(" << function << " @ " << line << ")] " << msg << std::endl;
+	(*m_output) << " [" << filen << "(" << rec.function << " @ " << rec.line << ")] ";
+
+	u32 i = 0;
+	while (i < rec.size) {
+		u8 type = rec.args[i++];
+		switch (type) {
+			case ArgInt: { i64 v; std::memcpy(&v, rec.args + i, sizeof(v)); i += sizeof(v); (*m_output) << v; } break;
+			case ArgUInt: { u64 v; std::memcpy(&v, rec.args + i, sizeof(v)); i += sizeof(v); (*m_output) << v; } break;
+			case ArgReal: { double v; std::memcpy(&v, rec.args + i, sizeof(v)); i += sizeof(v); (*m_output) << v; } break;
+			case ArgBool: { (*m_output) << (rec.args[i++] != 0); } break;
+			case ArgChar: { (*m_output) << char(rec.args[i++]); } break;
+			case ArgText:
+			{
+				u32 len;
+				std::memcpy(&len, rec.args + i, sizeof(len));
+				i += sizeof(len);
+				m_output->write(reinterpret_cast<const char*>(rec.args + i), len);
+				i += len;
+			} break;
+			default: i = rec.size; break;
+		}
+	}
+	if (rec.truncated) {
+		(*m_output) << "...";
+	}
+	(*m_output) << '\n';
 }
@@ -2,9 +2,16 @@
 #define LOGGER_H
 
 #include "Collections.h"
+#include "Memory.h"
 #include "Utils.h"
 #include <fstream>
 #include <iostream>
+#include <atomic>
+#include <thread>
+#include <ctime>
+#include <cstring>
+#include <sstream>
+#include <type_traits>
 
 enum LogLevel {
 	Debug = 0,
@@ -14,17 +21,178 @@ enum LogLevel {
 	Fatal
 };
 
+// Records in flight, power of two. Logging never blocks (except Fatal, which
+// waits for the output) and drops records while the ring is full.
+#define LOG_RING_SIZE 4096
+// Encoded arguments per record, longer messages are truncated
+#define LOG_ARGS_SIZE 232
+
+// Levels below this are compiled out
+#ifndef LOG_MIN_LEVEL
+#ifdef _DEBUG
+#define LOG_MIN_LEVEL LogLevel::Debug
+#else
+#define LOG_MIN_LEVEL LogLevel::Info
+#endif
+#endif
+
+enum LogArgType : u8 {
+	ArgInt = 0,
+	ArgUInt,
+	ArgReal,
+	ArgBool,
+	ArgChar,
+	ArgText
+};
+
+struct LogRecord {
+	LogLevel level;
+	int line;
+	const char* file;
+	const char* function;
+	std::time_t time;
+	u32 size;
+	bool truncated;
+	u8 args[LOG_ARGS_SIZE];
+};
+
+// Encodes log arguments as tagged binary values, the writer thread formats them.
+// Strings are copied, types without a binary form are formatted with operator<< here.
+class LogArgWriter {
+public:
+	LogArgWriter(LogRecord& rec) : m_rec(rec) {
+		m_rec.size = 0;
+		m_rec.truncated = false;
+	}
+
+	template <typename T>
+	void put(const T& value) {
+		using D = std::decay_t<T>;
+		if constexpr (std::is_same_v<D, bool>) {
+			scalar(ArgBool, u8(value ? 1 : 0));
+		} else if constexpr (std::is_same_v<D, char>) {
+			scalar(ArgChar, value);
+		} else if constexpr (std::is_enum_v<D>) {
+			scalar(ArgInt, i64(value));
+		} else if constexpr (std::is_integral_v<D> && std::is_signed_v<D>) {
+			scalar(ArgInt, i64(value));
+		} else if constexpr (std::is_integral_v<D>) {
+			scalar(ArgUInt, u64(value));
+		} else if constexpr (std::is_floating_point_v<D>) {
+			scalar(ArgReal, double(value));
+		} else if constexpr (std::is_same_v<D, const char*> || std::is_same_v<D, char*>) {
+			if (value == nullptr) text("(null)", 6);
+			else text(value, std::strlen(value));
+		} else if constexpr (std::is_same_v<D, String>) {
+			text(value.data(), value.size());
+		} else {
+			std::ostringstream oss;
+			oss << value;
+			const String str = oss.str();
+			text(str.data(), str.size());
+		}
+	}
+
+private:
+	LogRecord& m_rec;
+
+	template <typename T>
+	void scalar(LogArgType type, const T& v) {
+		if (m_rec.truncated || m_rec.size + 1 + sizeof(T) > LOG_ARGS_SIZE) {
+			m_rec.truncated = true;
+			return;
+		}
+		m_rec.args[m_rec.size++] = type;
+		std::memcpy(m_rec.args + m_rec.size, &v, sizeof(T));
+		m_rec.size += sizeof(T);
+	}
+
+	void text(const char* str, size_t length) {
+		const u32 header = 1 + sizeof(u32);
+		if (m_rec.truncated || m_rec.size + header > LOG_ARGS_SIZE) {
+			m_rec.truncated = true;
+			return;
+		}
+		u32 len = u32(length);
+		if (m_rec.size + header + len > LOG_ARGS_SIZE) {
+			len = LOG_ARGS_SIZE - m_rec.size - header;
+			m_rec.truncated = true;
+		}
+		m_rec.args[m_rec.size++] = ArgText;
+		std::memcpy(m_rec.args + m_rec.size, &len, sizeof(u32));
+		m_rec.size += sizeof(u32);
+		std::memcpy(m_rec.args + m_rec.size, str, len);
+		m_rec.size += len;
+	}
+};
+
+// log() encodes the arguments straight into a lock-free ring (any number of threads),
+// a background thread formats the records and writes them in batches.
 class Logger {
 public:
 	Logger();
 	Logger(std::ostream* output);
 	~Logger();
 
-	void print(LogLevel level, const char* file, const char* function, int line, const String& msg);
+	template <typename... Args>
+	void log(LogLevel level, const char* file, const char* function, int line, const Args&... args) {
+		u64 pos;
+		Slot* slot = reserve(level, pos);
+		if (slot == nullptr) return;
+
+		LogRecord& rec = slot->record;
+		rec.level = level;
+		rec.line = line;
+		rec.file = file;
+		rec.function = function;
+		rec.time = std::time(nullptr);
+
+		LogArgWriter writer(rec);
+		(writer.put(args), ...);
+
+		commit(slot, pos);
+	}
+
+	void print(LogLevel level, const char* file, const char* function, int line, const String& msg) {
+		log(level, file, function, line, msg);
+	}
+
+	// Runtime filter, checked before any argument is touched
+	bool enabled(LogLevel level) const { return level >= m_level.load(std::memory_order_relaxed); }
+	LogLevel level() const { return m_level.load(std::memory_order_relaxed); }
+	void level(LogLevel level) { m_level.store(level, std::memory_order_relaxed); }
+
+	// Blocks until everything printed so far has been written out
+	void flush();
+
+	// Records lost because the ring was full
+	u64 dropped() const { return m_dropped.load(std::memory_order_relaxed); }
 
 	static Logger& getSingleton() { return logger; }
 private:
 	std::ostream* m_output;
+	std::atomic<LogLevel> m_level;
+
+	struct Slot {
+		std::atomic<u64> sequence;
+		LogRecord record;
+	};
+	UPtr<Slot[]> m_ring;
+	std::atomic<u64> m_head, m_written, m_dropped;
+	u64 m_tail;
+
+	std::thread m_writer;
+	std::atomic<bool> m_running;
+
+	void start();
+	void writerLoop();
+	Slot* reserve(LogLevel level, u64& pos);
+	Slot* tryReserve(u64& pos);
+	void commit(Slot* slot, u64 pos);
+	void write(const LogRecord& record);
+
+	std::time_t m_lastTime;
+	char m_timeStamp[32];
 
 	static Logger logger;
 	static std::ofstream* logFile;
@@ -32,16 +200,9 @@ private:
 
 #define LOGGER Logger::getSingleton()
 
-template<typename T>
-String Str(const T& value) {
-	std::ostringstream oss;
-	oss << value;
-	return oss.str();
-}
-
-template<typename T, typename ... Args >
-String Str(const T& value, const Args& ... args) {
-	return Str(value) + Str(args...);
+template<typename ... Args>
+String Str(const Args& ... args) {
+	return Utils::concat(args...);
 }
 
 #ifdef __PRETTY_FUNCTION__
@@ -50,7 +211,9 @@ String Str(const T& value, const Args& ... args) {
 #define FUNCTION __FUNCTION__
 #endif
 
-#define Print(l, ...) LOGGER.print(l, __FILE__, FUNCTION, __LINE__, Utils::concat(__VA_ARGS__))
+#define Print(l, ...) do { \
+	if ((l) >= LOG_MIN_LEVEL && LOGGER.enabled(l)) LOGGER.log(l, __FILE__, FUNCTION, __LINE__, __VA_ARGS__); \
+} while (0)
 #define Log(...) Print(LogLevel::Debug, __VA_ARGS__)
 #define LogInfo(...) Print(LogLevel::Info, __VA_ARGS__)
 #define LogWarning(...) Print(LogLevel::Warning, __VA_ARGS__)
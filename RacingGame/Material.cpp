@@ -0,0 +1,70 @@
+#include "Material.h"
+
+#include "Logger.h"
+
+Material MaterialLibrary::add(ImageData& color, ImageData* normal, ImageData* specular) {
+	const u32 width = color.width(), height = color.height();
+	Page& page = findPage(width, height);
+	const u32 layer = page.used++;
+
+	auto sameSize = [&](ImageData* img, const char* name) {
+		if (img && (img->width() != width || img->height() != height)) {
+			LogWarning("Material ", name, " map is ", img->width(), "x", img->height(),
+				", expected ", width, "x", height, ". Using the default.");
+			return false;
+		}
+		return img != nullptr;
+	};
+
+	page.color.bind();
+	page.color.setLayer(layer, TextureCompressor::encodeCached(color, page.color.format()));
+
+	page.normal.bind();
+	if (sameSize(normal, "normal")) {
+		page.normal.setLayer(layer, TextureCompressor::encodeCached(*normal, page.normal.format(), false));
+	} else {
+		page.normal.setLayer(layer, page.flatNormal);
+	}
+
+	page.specular.bind();
+	if (sameSize(specular, "specular")) {
+		page.specular.setLayer(layer, TextureCompressor::encodeCached(*specular, page.specular.format(), false));
+	} else {
+		page.specular.setLayer(layer, page.noSpecular);
+	}
+
+	return { page.color.id(), page.normal.id(), page.specular.id(), layer, width, height };
+}
+
+MaterialLibrary::Page& MaterialLibrary::findPage(u32 width, u32 height) {
+	for (auto&& page : m_pages) {
+		if (page.color.width() == width && page.color.height() == height &&
+			page.used < MATERIAL_PAGE_LAYERS)
+		{
+			return page;
+		}
+	}
+
+	const TextureFormat rgba = TextureCompressor::supported(FormatBC3) ? FormatBC3 : FormatRGBA8;
+	auto make = [&](TextureFormat format) -> TextureArray {
+		return TextureArrayFactory::create()
+			.allocate(width, height, MATERIAL_PAGE_LAYERS, format)
+			.setFilter(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR)
+			.setWrap(GL_REPEAT, GL_REPEAT);
+	};
+
+	Page page{};
+	page.color = make(rgba);
+	page.normal = make(FormatBC5);
+	page.specular = make(rgba);
+	page.used = 0;
+
+	ImageData fill(width, height);
+	fill.fill(0x80, 0x80, 0xFF);
+	page.flatNormal = TextureCompressor::encode(fill, FormatBC5, false);
+	fill.fill(0, 0, 0);
+	page.noSpecular = TextureCompressor::encode(fill, rgba, false);
+
+	m_pages.push_back(std::move(page));
+	return m_pages.back();
+}
\ No newline at end of file
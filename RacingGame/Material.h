@@ -0,0 +1,38 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include "Texture.h"
+
+#define MATERIAL_PAGE_LAYERS 16
+
+// One layer of a MaterialLibrary page. Materials on the same page bind the
+// same textures, so any number of them can share a draw call.
+struct Material {
+	GLuint color, normal, specular; // GL_TEXTURE_2D_ARRAY ids
+	u32 layer;
+	u32 width, height;
+};
+
+// Color and specular maps are stored as BC3 and normal maps as BC5 where the
+// driver supports it, RGBA8 otherwise
+class MaterialLibrary {
+public:
+	// Missing maps get a flat normal and no specular
+	Material add(ImageData& color, ImageData* normal, ImageData* specular);
+
+	u32 pageCount() const { return u32(m_pages.size()); }
+
+private:
+	// All layers of a page have the size of the first material put in it
+	struct Page {
+		TextureArray color, normal, specular;
+		CompressedImage flatNormal, noSpecular; // layers for missing maps
+		u32 used;
+	};
+
+	Vec<Page> m_pages;
+
+	Page& findPage(u32 width, u32 height);
+};
+
+#endif // MATERIAL_H
\ No newline at end of file
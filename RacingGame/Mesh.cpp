@@ -1,18 +1,195 @@
 #include "Mesh.h"
 
+#include "glm/common.hpp"
+
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+// Vector paths for the mesh kernels. Each vec3 lives in one register (xyz, w unused)
+// and goes through the same operations in the same order as the glm code, so the
+// results are bit-identical to the scalar fallback. AVX2 (/arch:AVX2) additionally
+// transforms two vertices per register.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MESH_SSE 1
+#define MESH_AVX2 1
+#elif defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MESH_SSE 1
+#endif
+
+#ifndef MESH_SSE
+#define MESH_SSE 0
+#endif
+#ifndef MESH_AVX2
+#define MESH_AVX2 0
+#endif
+
+#if MESH_SSE
+// 8 + 4 byte accesses, so neither side touches the float after the vec3
+static inline __m128 load3(const glm::vec3& v) {
+	return _mm_movelh_ps(_mm_castpd_ps(_mm_load_sd((const double*) &v.x)), _mm_load_ss(&v.z));
+}
+
+static inline void store3(glm::vec3& v, __m128 r) {
+	_mm_store_sd((double*) &v.x, _mm_castps_pd(r));
+	_mm_store_ss(&v.z, _mm_movehl_ps(r, r));
+}
+
+// glm::normalize: v * (1 / sqrt((x*x + y*y) + z*z))
+static inline __m128 normalize3(__m128 v) {
+	const __m128 sq = _mm_mul_ps(v, v);
+	const __m128 dot = _mm_add_ss(_mm_add_ss(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1, 1, 1, 1))), _mm_movehl_ps(sq, sq));
+	const __m128 inv = _mm_div_ss(_mm_set_ss(1.0f), _mm_sqrt_ss(dot));
+	return _mm_mul_ps(v, _mm_shuffle_ps(inv, inv, _MM_SHUFFLE(0, 0, 0, 0)));
+}
+#endif
+
+void Vertex::setupAttributes() {
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	glEnableVertexAttribArray(3);
+	glEnableVertexAttribArray(4);
+	glEnableVertexAttribArray(5);
+
+	glVertexAttribPointer(0, 3, GL_FLOAT, false, sizeof(Vertex), (void*) offsetof(Vertex, position));
+	glVertexAttribPointer(1, 3, GL_FLOAT, false, sizeof(Vertex), (void*) offsetof(Vertex, normal));
+	glVertexAttribPointer(2, 3, GL_FLOAT, false, sizeof(Vertex), (void*) offsetof(Vertex, tangent));
+	glVertexAttribPointer(3, 2, GL_FLOAT, false, sizeof(Vertex), (void*) offsetof(Vertex, texCoord));
+	glVertexAttribPointer(4, 4, GL_FLOAT, false, sizeof(Vertex), (void*) offsetof(Vertex, color));
+	glVertexAttribPointer(5, 1, GL_FLOAT, false, sizeof(Vertex), (void*) offsetof(Vertex, layer));
+}
+
+static u16 toHalf(float f) {
+	u32 bits;
+	std::memcpy(&bits, &f, sizeof(bits));
+	const u32 sign = (bits >> 16) & 0x8000;
+	const i32 exponent = i32((bits >> 23) & 0xFF) - 127 + 15;
+	u32 mantissa = bits & 0x7FFFFF;
+
+	if (exponent <= 0) {
+		// Subnormal or zero, rounded to nearest
+		if (exponent < -10) return u16(sign);
+		mantissa |= 0x800000;
+		const u32 shift = u32(14 - exponent);
+		return u16(sign | ((mantissa + (1u << (shift - 1))) >> shift));
+	}
+	if (exponent >= 31) {
+		return u16(sign | 0x7C00); // fits() keeps values far from this
+	}
+	// Rounding may carry into the exponent, which is still the right result
+	return u16(sign | ((u32(exponent) << 10) + ((mantissa + 0x1000) >> 13)));
+}
+
+static i16 toSnorm16(float f) {
+	return i16(std::round(glm::clamp(f, -1.0f, 1.0f) * 32767.0f));
+}
+
+// Unit vector to a point on the octahedron, folded onto the z >= 0 square.
+// Zero vectors (sprite normals) come out as +Z.
+static void octEncode(const glm::vec3& n, i16 out[2]) {
+	const float len = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (len <= 0.0f) {
+		out[0] = out[1] = 0;
+		return;
+	}
+	glm::vec2 p = glm::vec2(n) / len;
+	if (n.z < 0.0f) {
+		p = (1.0f - glm::abs(glm::vec2(p.y, p.x))) * glm::vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	out[0] = toSnorm16(p.x);
+	out[1] = toSnorm16(p.y);
+}
+
+CompactVertex::CompactVertex(const Vertex& v) {
+	position = v.position;
+	octEncode(v.normal, normal);
+	octEncode(v.tangent, tangent);
+	texCoord[0] = toHalf(v.texCoord.x);
+	texCoord[1] = toHalf(v.texCoord.y);
+	for (u32 i = 0; i < 4; i++) {
+		color[i] = u8(std::round(glm::clamp(v.color[i], 0.0f, 1.0f) * 255.0f));
+	}
+	layer = u16(v.layer);
+	padding = 0;
+}
+
+bool CompactVertex::fits(const Vertex& v) {
+	return
+		std::abs(v.texCoord.x) <= 1.0f && std::abs(v.texCoord.y) <= 1.0f &&
+		v.color.r >= 0.0f && v.color.r <= 1.0f &&
+		v.color.g >= 0.0f && v.color.g <= 1.0f &&
+		v.color.b >= 0.0f && v.color.b <= 1.0f &&
+		v.color.a >= 0.0f && v.color.a <= 1.0f &&
+		v.layer >= 0.0f && v.layer < 65536.0f && v.layer == std::floor(v.layer);
+}
+
+void CompactVertex::setupAttributes() {
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	glEnableVertexAttribArray(3);
+	glEnableVertexAttribArray(4);
+	glEnableVertexAttribArray(5);
+
+	glVertexAttribPointer(0, 3, GL_FLOAT, false, sizeof(CompactVertex), (void*) offsetof(CompactVertex, position));
+	glVertexAttribPointer(1, 2, GL_SHORT, true, sizeof(CompactVertex), (void*) offsetof(CompactVertex, normal));
+	glVertexAttribPointer(2, 2, GL_SHORT, true, sizeof(CompactVertex), (void*) offsetof(CompactVertex, tangent));
+	glVertexAttribPointer(3, 2, GL_HALF_FLOAT, false, sizeof(CompactVertex), (void*) offsetof(CompactVertex, texCoord));
+	glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, true, sizeof(CompactVertex), (void*) offsetof(CompactVertex, color));
+	glVertexAttribPointer(5, 1, GL_UNSIGNED_SHORT, false, sizeof(CompactVertex), (void*) offsetof(CompactVertex, layer));
+}
+
+void Mesh::updateBounds() {
+	if (m_vertices.empty()) {
+		m_boundsMin = m_boundsMax = glm::vec3(0.0f);
+		return;
+	}
+#if MESH_SSE
+	__m128 lo = load3(m_vertices[0].position), hi = lo;
+	for (const Vertex& v : m_vertices) {
+		const __m128 p = load3(v.position);
+		lo = _mm_min_ps(lo, p);
+		hi = _mm_max_ps(hi, p);
+	}
+	store3(m_boundsMin, lo);
+	store3(m_boundsMax, hi);
+#else
+	m_boundsMin = m_boundsMax = m_vertices[0].position;
+	for (const Vertex& v : m_vertices) {
+		m_boundsMin = glm::min(m_boundsMin, v.position);
+		m_boundsMax = glm::max(m_boundsMax, v.position);
+	}
+#endif
+}
+
 void Mesh::calculateTangents() {
 	for (u32 i = 0; i < m_indices.size(); i += 3) {
 		Vertex& v0 = m_vertices[m_indices[i + 0]];
 		Vertex& v1 = m_vertices[m_indices[i + 1]];
 		Vertex& v2 = m_vertices[m_indices[i + 2]];
 
-		glm::vec3 edge1 = v2.position - v0.position;
-		glm::vec3 edge2 = v1.position - v0.position;
 		glm::vec2 deltaUV1 = v2.texCoord - v0.texCoord;
 		glm::vec2 deltaUV2 = v1.texCoord - v0.texCoord;
 
 		float f = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
 
+#if MESH_SSE
+		const __m128 p0 = load3(v0.position);
+		const __m128 edge1 = _mm_sub_ps(load3(v2.position), p0);
+		const __m128 edge2 = _mm_sub_ps(load3(v1.position), p0);
+		__m128 tang = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(deltaUV2.y), edge1), _mm_mul_ps(_mm_set1_ps(deltaUV1.y), edge2));
+		tang = normalize3(_mm_mul_ps(_mm_set1_ps(f), tang));
+
+		store3(v0.tangent, _mm_add_ps(load3(v0.tangent), tang));
+		store3(v1.tangent, _mm_add_ps(load3(v1.tangent), tang));
+		store3(v2.tangent, _mm_add_ps(load3(v2.tangent), tang));
+#else
+		glm::vec3 edge1 = v2.position - v0.position;
+		glm::vec3 edge2 = v1.position - v0.position;
+
 		glm::vec3 tang{};
 		tang.x = f * (deltaUV2.y * edge1.x - deltaUV1.y * edge2.x);
 		tang.y = f * (deltaUV2.y * edge1.y - deltaUV1.y * edge2.y);
@@ -22,10 +199,15 @@ void Mesh::calculateTangents() {
 		v0.tangent += tang;
 		v1.tangent += tang;
 		v2.tangent += tang;
+#endif
 	}
 	
 	for (Vertex& v : m_vertices) {
+#if MESH_SSE
+		store3(v.tangent, normalize3(load3(v.tangent)));
+#else
 		v.tangent = glm::normalize(v.tangent);
+#endif
 	}
 }
 
@@ -35,6 +217,21 @@ void Mesh::calculateNormals() {
 		Vertex& v1 = m_vertices[m_indices[i + 1]];
 		Vertex& v2 = m_vertices[m_indices[i + 2]];
 
+#if MESH_SSE
+		const __m128 p0 = load3(v0.position);
+		const __m128 edge1 = _mm_sub_ps(load3(v2.position), p0);
+		const __m128 edge2 = _mm_sub_ps(load3(v1.position), p0);
+
+		// cross(edge1, edge2) = edge1.yzx * edge2.zxy - edge2.yzx * edge1.zxy
+		const __m128 n = normalize3(_mm_sub_ps(
+			_mm_mul_ps(_mm_shuffle_ps(edge1, edge1, _MM_SHUFFLE(3, 0, 2, 1)), _mm_shuffle_ps(edge2, edge2, _MM_SHUFFLE(3, 1, 0, 2))),
+			_mm_mul_ps(_mm_shuffle_ps(edge2, edge2, _MM_SHUFFLE(3, 0, 2, 1)), _mm_shuffle_ps(edge1, edge1, _MM_SHUFFLE(3, 1, 0, 2)))
+		));
+
+		store3(v0.normal, _mm_add_ps(load3(v0.normal), n));
+		store3(v1.normal, _mm_add_ps(load3(v1.normal), n));
+		store3(v2.normal, _mm_add_ps(load3(v2.normal), n));
+#else
 		glm::vec3 edge1 = v2.position - v0.position;
 		glm::vec3 edge2 = v1.position - v0.position;
 		glm::vec3 n = glm::normalize(glm::cross(edge1, edge2));
@@ -42,15 +239,76 @@ void Mesh::calculateNormals() {
 		v0.normal += n;
 		v1.normal += n;
 		v2.normal += n;
+#endif
 	}
 
 	for (Vertex& v : m_vertices) {
+#if MESH_SSE
+		store3(v.normal, normalize3(load3(v.normal)));
+#else
 		v.normal = glm::normalize(v.normal);
+#endif
 	}
 }
 
 void Mesh::transform(const glm::mat4& modelMatrix) {
-	for (Vertex& v : m_vertices) {
+	if (m_vertices.empty()) return;
+
+	// The bounds are gathered on the way instead of in a second pass
+	u32 i = 0;
+#if MESH_SSE
+	__m128 lo = _mm_set1_ps(FLT_MAX), hi = _mm_set1_ps(-FLT_MAX);
+#endif
+#if MESH_AVX2
+	// Two vertices per register, one in each 128 bit half
+	const __m256 col0 = _mm256_broadcast_ps((const __m128*) &modelMatrix[0][0]);
+	const __m256 col1 = _mm256_broadcast_ps((const __m128*) &modelMatrix[1][0]);
+	const __m256 col2 = _mm256_broadcast_ps((const __m128*) &modelMatrix[2][0]);
+	const __m256 col3 = _mm256_broadcast_ps((const __m128*) &modelMatrix[3][0]);
+	__m256 lo2 = _mm256_set1_ps(FLT_MAX), hi2 = _mm256_set1_ps(-FLT_MAX);
+	for (; i + 2 <= m_vertices.size(); i += 2) {
+		const glm::vec3& a = m_vertices[i + 0].position;
+		const glm::vec3& b = m_vertices[i + 1].position;
+		const __m256 x = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(a.x)), _mm_set1_ps(b.x), 1);
+		const __m256 y = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(a.y)), _mm_set1_ps(b.y), 1);
+		const __m256 z = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(a.z)), _mm_set1_ps(b.z), 1);
+		const __m256 r = _mm256_add_ps(
+			_mm256_add_ps(_mm256_mul_ps(col0, x), _mm256_mul_ps(col1, y)),
+			_mm256_add_ps(_mm256_mul_ps(col2, z), col3)
+		);
+		store3(m_vertices[i + 0].position, _mm256_castps256_ps128(r));
+		store3(m_vertices[i + 1].position, _mm256_extractf128_ps(r, 1));
+		lo2 = _mm256_min_ps(lo2, r);
+		hi2 = _mm256_max_ps(hi2, r);
+	}
+	lo = _mm_min_ps(_mm256_castps256_ps128(lo2), _mm256_extractf128_ps(lo2, 1));
+	hi = _mm_max_ps(_mm256_castps256_ps128(hi2), _mm256_extractf128_ps(hi2, 1));
+#endif
+#if MESH_SSE
+	const __m128 c0 = _mm_loadu_ps(&modelMatrix[0][0]);
+	const __m128 c1 = _mm_loadu_ps(&modelMatrix[1][0]);
+	const __m128 c2 = _mm_loadu_ps(&modelMatrix[2][0]);
+	const __m128 c3 = _mm_loadu_ps(&modelMatrix[3][0]);
+	for (; i < m_vertices.size(); i++) {
+		glm::vec3& p = m_vertices[i].position;
+		const __m128 r = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p.x)), _mm_mul_ps(c1, _mm_set1_ps(p.y))),
+			_mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p.z)), c3)
+		);
+		store3(p, r);
+		lo = _mm_min_ps(lo, r);
+		hi = _mm_max_ps(hi, r);
+	}
+	store3(m_boundsMin, lo);
+	store3(m_boundsMax, hi);
+#else
+	m_boundsMin = glm::vec3(FLT_MAX);
+	m_boundsMax = glm::vec3(-FLT_MAX);
+	for (; i < m_vertices.size(); i++) {
+		Vertex& v = m_vertices[i];
 		v.position = glm::vec3(modelMatrix * glm::vec4(v.position, 1.0f));
+		m_boundsMin = glm::min(m_boundsMin, v.position);
+		m_boundsMax = glm::max(m_boundsMax, v.position);
 	}
+#endif
 }
\ No newline at end of file
@@ -14,6 +14,30 @@ struct Vertex {
 	glm::vec3 position, normal, tangent;
 	glm::vec2 texCoord;
 	glm::vec4 color;
+	float layer; // for array texture materials
+
+	// Attribute pointers for the bound VAO and GL_ARRAY_BUFFER
+	static void setupAttributes();
+};
+
+// Half the size of Vertex, for vertices that fit it (see fits()). Normal and
+// tangent are octahedral encoded, UVs are half floats and the color is RGBA8.
+// Same attribute locations, uber.vert decodes it with HAS_COMPACT_VERTEX.
+struct CompactVertex {
+	glm::vec3 position;
+	i16 normal[2], tangent[2];
+	u16 texCoord[2];
+	u8 color[4];
+	u16 layer, padding;
+
+	CompactVertex() = default;
+	CompactVertex(const Vertex& v);
+
+	// UVs in [-1, 1], where half floats are good to a texel of a 2048 texture,
+	// colors in [0, 1] and an integer layer
+	static bool fits(const Vertex& v);
+
+	static void setupAttributes();
 };
 #pragma pack(pop)
 
@@ -22,10 +46,14 @@ public:
 	Mesh() = default;
 	~Mesh() = default;
 
-	void vertices(const Vec<Vertex>& verts) { m_vertices = verts; }
+	void vertices(const Vec<Vertex>& verts) { m_vertices = verts; updateBounds(); }
 	void indices(const Vec<u32>& inds) { m_indices = inds; }
-	Vec<Vertex> vertices() const { return m_vertices; }
-	Vec<u32> indices() const { return m_indices; }
+	const Vec<Vertex>& vertices() const { return m_vertices; }
+	const Vec<u32>& indices() const { return m_indices; }
+
+	// Local bounding box of the positions, kept up to date by vertices() and transform()
+	const glm::vec3& boundsMin() const { return m_boundsMin; }
+	const glm::vec3& boundsMax() const { return m_boundsMax; }
 
 	void calculateTangents();
 	void calculateNormals();
@@ -35,6 +63,9 @@ public:
 protected:
 	Vec<Vertex> m_vertices;
 	Vec<u32> m_indices;
+
+	glm::vec3 m_boundsMin{ 0.0f }, m_boundsMax{ 0.0f };
+	void updateBounds();
 };
 
 #endif // MESH_H
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include "Profiler.h"
+
+#include "Logger.h"
+#include <fstream>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PROFILER_HAS_TSC
+#endif
+
+Profiler& Profiler::get() {
+	static Profiler profiler;
+	return profiler;
+}
+
+u64 Profiler::now() {
+#ifdef PROFILER_HAS_TSC
+	return __rdtsc();
+#else
+	return Utils::nanoTime();
+#endif
+}
+
+Profiler::Profiler() {
+	// Measure the TSC rate against the OS clock once
+	u64 t0 = Utils::nanoTime();
+	u64 c0 = now();
+	while (Utils::nanoTime() - t0 < 10000000);
+	u64 t1 = Utils::nanoTime();
+	u64 c1 = now();
+
+	m_ticksPerMicrosecond = double(c1 - c0) / (double(t1 - t0) / 1000.0);
+	m_baseTicks = c0;
+}
+
+ProfileRing& Profiler::ring() {
+	thread_local ProfileRing* tlsRing = nullptr;
+	if (tlsRing == nullptr) {
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_rings.push_back(UPtr<ProfileRing>(new ProfileRing(u32(m_rings.size()))));
+		tlsRing = m_rings.back().get();
+	}
+	return *tlsRing;
+}
+
+void Profiler::exportTrace(const String& fileName) {
+	std::ofstream fs(fileName);
+	if (!fs.good()) {
+		LogError("Could not write trace: \"", fileName, "\"");
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	fs << "{\"traceEvents\":[\n";
+	bool first = true;
+	for (auto&& ring : m_rings) {
+		u64 head = ring->m_head.load(std::memory_order_acquire);
+		u64 begin = head > PROFILER_RING_SIZE ? head - PROFILER_RING_SIZE : 0;
+		for (u64 i = begin; i < head; i++) {
+			const ProfileEvent& e = ring->m_events[i % PROFILER_RING_SIZE];
+			if (!first) fs << ",\n";
+			first = false;
+
+			fs << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << ring->m_threadID
+				<< ",\"ts\":" << toMicroseconds(e.start)
+				<< ",\"dur\":" << (double(e.end - e.start) / m_ticksPerMicrosecond)
+				<< ",\"args\":{\"depth\":" << e.depth << "}}";
+		}
+	}
+	fs << "\n]}\n";
+
+	LogInfo("Trace written: \"", fileName, "\"");
+}
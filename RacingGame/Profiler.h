@@ -0,0 +1,104 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// Scoped hot-path profiler
+// Zones are timed with the TSC and recorded into per-thread ring buffers,
+// then exported as Chrome trace-event JSON (chrome://tracing, Perfetto).
+
+#include "Int.h"
+#include "Memory.h"
+#include "Collections.h"
+
+#include <atomic>
+#include <mutex>
+
+#ifndef PROFILER_ENABLED
+#ifdef _DEBUG
+#define PROFILER_ENABLED 1
+#else
+#define PROFILER_ENABLED 0
+#endif
+#endif
+
+#define PROFILER_RING_SIZE 65536
+
+struct ProfileEvent {
+	const char* name;
+	u64 start, end;
+	u32 depth;
+};
+
+// Single writer (the owning thread), oldest events are overwritten
+class ProfileRing {
+	friend class Profiler;
+public:
+	ProfileRing(u32 threadID) : m_threadID(threadID), m_head(0), m_depth(0) {
+		m_events.resize(PROFILER_RING_SIZE);
+	}
+
+	u32 enter() { return m_depth++; }
+	void leave(const char* name, u64 start, u64 end) {
+		u64 head = m_head.load(std::memory_order_relaxed);
+		m_events[head % PROFILER_RING_SIZE] = { name, start, end, --m_depth };
+		m_head.store(head + 1, std::memory_order_release);
+	}
+
+private:
+	u32 m_threadID;
+	Vec<ProfileEvent> m_events;
+	std::atomic<u64> m_head;
+	u32 m_depth;
+};
+
+class Profiler {
+public:
+	static Profiler& get();
+
+	static u64 now();
+
+	// Ring of the calling thread, registered on first use
+	ProfileRing& ring();
+
+	double toMicroseconds(u64 ticks) const { return double(ticks - m_baseTicks) / m_ticksPerMicrosecond; }
+
+	// Should be called while no other thread is recording (e.g. at exit)
+	void exportTrace(const String& fileName);
+
+private:
+	Profiler();
+
+	std::mutex m_lock;
+	Vec<UPtr<ProfileRing>> m_rings;
+
+	u64 m_baseTicks;
+	double m_ticksPerMicrosecond;
+};
+
+class ProfileScope {
+public:
+	ProfileScope(const char* name)
+		: m_name(name), m_ring(Profiler::get().ring())
+	{
+		m_ring.enter();
+		m_start = Profiler::now();
+	}
+
+	~ProfileScope() {
+		m_ring.leave(m_name, m_start, Profiler::now());
+	}
+
+private:
+	const char* m_name;
+	ProfileRing& m_ring;
+	u64 m_start;
+};
+
+#if PROFILER_ENABLED
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define ProfileZone(name) ProfileScope PROFILE_CONCAT(_profileZone, __LINE__)(name)
+#else
+#define ProfileZone(name)
+#endif
+
+#endif // PROFILER_H
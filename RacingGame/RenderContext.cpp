@@ -1,30 +1,61 @@
 #include "RenderContext.h"
+#include "StaticGeometry.h"
+#include "ThreadPool.h"
 
 #include "Utils.h"
+#include "Logger.h"
+#include "Profiler.h"
 #include "glm/gtc/matrix_transform.hpp"
 
+#define DRAWABLE_INDEX_BITS 20
+#define DRAWABLE_INDEX_MASK ((1u << DRAWABLE_INDEX_BITS) - 1)
+
+// Objects per parallelSubmit job
+#define SUBMIT_JOB_GRAIN 16
+
+static const glm::mat4 Identity(1.0f);
+
+static thread_local CommandBuffer* t_jobCommands = nullptr;
+
+// Whether every vertex survives packing, with the layer the drawable gives them
+static bool fitsCompact(const Vec<Vertex>& verts, float layer) {
+	for (Vertex v : verts) {
+		v.layer = layer;
+		if (!CompactVertex::fits(v)) return false;
+	}
+	return true;
+}
+
 RenderContext::RenderContext() {
 	m_lightCount = 0;
+	m_jobCount = 0;
+	m_alpha = 1.0f;
+	m_vboSize = 0;
+	m_compactVboSize = 0;
+	m_eboSize = 0;
+	m_stats = {};
+	m_frameStats = {};
+	m_state.reset();
+	m_commands.clear();
+	m_projection = Identity;
+	m_view = Identity;
+	updateFrustum();
 
 	glGenBuffers(1, &m_vbo);
+	glGenBuffers(1, &m_compactVbo);
 	glGenBuffers(1, &m_ebo);
 	glGenVertexArrays(1, &m_vao);
+	glGenVertexArrays(1, &m_compactVao);
 
 	glBindVertexArray(m_vao);
 	glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+	Vertex::setupAttributes();
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo);
 
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
-	glEnableVertexAttribArray(3);
-	glEnableVertexAttribArray(4);
-
-	glVertexAttribPointer(0, 3, GL_FLOAT, false, sizeof(Vertex), (void*) offsetof(Vertex, position));
-	glVertexAttribPointer(1, 3, GL_FLOAT, false, sizeof(Vertex), (void*) offsetof(Vertex, normal));
-	glVertexAttribPointer(2, 3, GL_FLOAT, false, sizeof(Vertex), (void*) offsetof(Vertex, tangent));
-	glVertexAttribPointer(3, 2, GL_FLOAT, false, sizeof(Vertex), (void*) offsetof(Vertex, texCoord));
-	glVertexAttribPointer(4, 4, GL_FLOAT, false, sizeof(Vertex), (void*) offsetof(Vertex, color));
-
+	// Same element buffer, batches of both layouts index into it
+	glBindVertexArray(m_compactVao);
+	glBindBuffer(GL_ARRAY_BUFFER, m_compactVbo);
+	CompactVertex::setupAttributes();
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo);
 
 	glBindVertexArray(0);
@@ -37,10 +68,12 @@ RenderContext::RenderContext() {
 #include "uber.frag"
 		;
 
-	m_shader = ShaderFactory::create()
-		.addSource(ShaderProgram::VertexShader, VS)
-		.addSource(ShaderProgram::FragmentShader, FS)
-		.link();
+	// Same order as ShaderFeature
+	m_shaders = ShaderPermutations(VS, FS, {
+		"HAS_NORMAL_MAP", "HAS_SPECULAR_MAP", "HAS_ENVIRONMENT",
+		"HAS_SUN_LIGHTS", "HAS_POINT_LIGHTS", "HAS_SPOT_LIGHTS",
+		"HAS_TEXTURE_ARRAY", "HAS_COMPACT_VERTEX"
+	});
 
 	glEnable(GL_DEPTH_TEST);
 	glDisable(GL_CULL_FACE);
@@ -50,86 +83,322 @@ RenderContext::RenderContext() {
 
 RenderContext::~RenderContext() {
 	glDeleteBuffers(1, &m_vbo);
+	glDeleteBuffers(1, &m_compactVbo);
 	glDeleteBuffers(1, &m_ebo);
 	glDeleteVertexArrays(1, &m_vao);
+	glDeleteVertexArrays(1, &m_compactVao);
+}
+
+void RenderContext::beginFrame() {
+	m_frameStats = m_stats;
+	m_stats = {};
 }
 
 void RenderContext::begin() {
-	m_drawables.clear();
+	m_commands.clear();
+	m_jobCount = 0;
 }
 
 void RenderContext::end() {
+	ProfileZone("RenderContext::end");
+	mergeJobCommands();
 	updateBufferData();
 
-	m_shader.use();
+	// Sorted by type, the shader runs one loop per type instead of branching per light
+	Array<Light, MAX_LIGHTS> lights;
+	u32 counts[3] = { 0, 0, 0 };
+	u32 lightCount = 0;
+	for (u32 type = Light::Sun; type <= Light::Spot; type++) {
+		for (u32 i = 0; i < m_lightCount; i++) {
+			if (m_lights[i].type == type) {
+				lights[lightCount++] = m_lights[i];
+				counts[type - Light::Sun]++;
+			}
+		}
+	}
 
-	m_shader.get("uView").set(m_view);
-	m_shader.get("uProj").set(m_projection);
-	m_shader.get("uModel").set(glm::mat4(1.0f));
-	m_shader.get("uHasNormal").set(false);
-	m_shader.get("uHasSpecular").set(false);
-	m_shader.get("uHasEnv").set(false);
+	u32 frameFeatures = 0;
+	if (m_environment.id() > 0) frameFeatures |= FeatureEnvironment;
+	if (counts[0] > 0) frameFeatures |= FeatureSunLights;
+	if (counts[1] > 0) frameFeatures |= FeaturePointLights;
+	if (counts[2] > 0) frameFeatures |= FeatureSpotLights;
 
-	u32 startSlot = 0;
-	m_shader.get("uAmbient").set(m_ambient);
+	// DebugDraw and the application may have changed bindings since the last pass
+	m_state.reset();
 	if (m_environment.id() > 0) {
-		m_environment.bind(startSlot);
-		m_shader.get("uEnv").set(startSlot);
-		m_shader.get("uHasEnv").set(true);
-		startSlot++;
+		bindTexture(GL_TEXTURE_2D, m_environment.id(), SlotEnvironment);
 	}
 
-	m_shader.get("uLightCount").set(m_lightCount);
-	for (u32 i = 0; i < m_lightCount; i++) {
-		Light li = m_lights[i];
-		const String light = Utils::concat("uLights[", i, "].");
-		m_shader.get(light + "position").set(li.position);
-		m_shader.get(light + "direction").set(li.direction);
-		m_shader.get(light + "color").set(li.color);
-		m_shader.get(light + "intensity").set(li.intensity);
-		m_shader.get(light + "radius").set(li.radius);
-		m_shader.get(light + "spotCutoff").set(li.spotCutoff);
-		m_shader.get(light + "type").set(u32(li.type));
-	}
-
-	glBindVertexArray(m_vao);
-	for (Batch b : m_batches) {
-		if (b.transform) {
-			m_shader.get("uModel").set(b.modelMatrix);
+	auto draw = [&](const Batch& b) {
+		const u32 features = b.features | frameFeatures;
+		ShaderProgram& prog = m_shaders.get(features);
+		if (useProgram(prog) &&
+			std::find(m_state.framePrograms.begin(), m_state.framePrograms.end(), &prog) == m_state.framePrograms.end())
+		{
+			setFrameUniforms(prog, features, lights, counts);
+			m_state.framePrograms.push_back(&prog);
 		}
 
-		u32 slot = startSlot;
-		if (b.color.id() > 0) {
-			b.color.bind(slot);
-			m_shader.get("uColor").set(slot);
-			slot++;
+		setModelMatrix(b.matrix);
+		const GLenum target = (b.features & FeatureTextureArray) ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+		if (b.color > 0) {
+			bindTexture(target, b.color, SlotColor);
 		}
-		if (b.normal.id() > 0) {
-			b.normal.bind(slot);
-			m_shader.get("uNormal").set(slot);
-			m_shader.get("uHasNormal").set(true);
-			slot++;
+		if (b.features & FeatureNormalMap) {
+			bindTexture(target, b.normal, SlotNormal);
 		}
-		if (b.specular.id() > 0) {
-			b.specular.bind(slot);
-			m_shader.get("uSpecular").set(slot);
-			m_shader.get("uHasSpecular").set(true);
-			slot++;
+		if (b.features & FeatureSpecularMap) {
+			bindTexture(target, b.specular, SlotSpecular);
 		}
 
-		glDrawElements(
+		const size_t indexSize = b.indexType == GL_UNSIGNED_SHORT ? sizeof(u16) : sizeof(u32);
+		glDrawElementsBaseVertex(
 			GL_TRIANGLES,
 			b.length,
-			GL_UNSIGNED_INT,
-			(void*) (b.offset * 4)
+			b.indexType,
+			(void*) (b.offset * indexSize),
+			GLint(b.baseVertex)
 		);
+		m_stats.drawCalls++;
+	};
+
+	for (StaticGeometry* geometry : m_staticGeometry) {
+		if (!geometry->upload()) continue;
+		glBindVertexArray(geometry->m_vao);
+		for (const Batch& b : geometry->m_batches) {
+			draw(b);
+		}
+	}
+
+	GLuint vao = 0;
+	for (const Batch& b : m_batches) {
+		const GLuint batchVao = (b.features & FeatureCompactVertex) ? m_compactVao : m_vao;
+		if (batchVao != vao) {
+			glBindVertexArray(batchVao);
+			vao = batchVao;
+		}
+		draw(b);
 	}
 	glBindVertexArray(0);
 
 	m_batches.clear();
+	m_staticGeometry.clear();
 	m_lightCount = 0;
 }
 
+CommandBuffer& RenderContext::commands() {
+	return t_jobCommands != nullptr ? *t_jobCommands : m_commands;
+}
+
+void RenderContext::parallelSubmit(u32 count, const std::function<void(u32)>& fn) {
+	ProfileZone("parallelSubmit");
+	const u32 first = m_jobCount;
+	const u32 jobs = (count + SUBMIT_JOB_GRAIN - 1) / SUBMIT_JOB_GRAIN;
+	while (m_jobCommands.size() < first + jobs) {
+		m_jobCommands.emplace_back(new CommandBuffer());
+	}
+	m_jobCount += jobs;
+
+	ThreadPool::get().parallelFor(count, SUBMIT_JOB_GRAIN, [&](u32 begin, u32 end) {
+		ProfileZone("SubmitJob");
+		CommandBuffer& cb = *m_jobCommands[first + begin / SUBMIT_JOB_GRAIN];
+		cb.clear();
+		cb.cursor = m_commands.cursor;
+
+		t_jobCommands = &cb;
+		for (u32 i = begin; i < end; i++) {
+			fn(i);
+		}
+		t_jobCommands = nullptr;
+	});
+}
+
+void RenderContext::mergeJobCommands() {
+	ProfileZone("mergeJobCommands");
+	CommandBuffer& dst = m_commands;
+	for (const Light& light : dst.lights) {
+		addLight(light);
+	}
+	m_stats.culled += dst.culled;
+
+	for (u32 j = 0; j < m_jobCount; j++) {
+		const CommandBuffer& src = *m_jobCommands[j];
+		const u32 vertexBase = u32(dst.vertices.size());
+		const u32 indexBase = u32(dst.indices.size());
+		const u32 matrixBase = u32(dst.matrices.size());
+
+		if (dst.drawables.size() + src.drawables.size() > DRAWABLE_INDEX_MASK + 1) {
+			LogWarning("Too many drawables this pass, job skipped");
+			continue;
+		}
+		for (Drawable d : src.drawables) {
+			d.vertexOffset += vertexBase;
+			d.indexOffset += indexBase;
+			if (d.matrix != NO_TRANSFORM) d.matrix += matrixBase;
+			dst.drawables.push_back(d);
+		}
+		dst.matrices.insert(dst.matrices.end(), src.matrices.begin(), src.matrices.end());
+		dst.vertices.insert(dst.vertices.end(), src.vertices.begin(), src.vertices.end());
+		dst.indices.insert(dst.indices.end(), src.indices.begin(), src.indices.end());
+
+		for (const Light& light : src.lights) {
+			addLight(light);
+		}
+		m_stats.culled += src.culled;
+	}
+	m_jobCount = 0;
+}
+
+void RenderContext::updateFrustum() {
+	// Rows of the clip matrix combined per plane (Gribb & Hartmann)
+	const glm::mat4 m = m_projection * m_view;
+	for (u32 i = 0; i < 3; i++) {
+		for (u32 c = 0; c < 4; c++) {
+			m_frustum[i * 2 + 0][c] = m[c][3] + m[c][i];
+			m_frustum[i * 2 + 1][c] = m[c][3] - m[c][i];
+		}
+	}
+}
+
+bool RenderContext::visible(const glm::vec3* points, u32 count) const {
+	for (const glm::vec4& plane : m_frustum) {
+		u32 outside = 0;
+		for (u32 i = 0; i < count; i++) {
+			if (glm::dot(glm::vec3(plane), points[i]) + plane.w < 0.0f) outside++;
+		}
+		if (outside == count) return false;
+	}
+	return true;
+}
+
+void RenderContext::addLight(const Light& light) {
+	m_lights[m_lightCount % MAX_LIGHTS] = light;
+	m_lightCount++;
+	m_lightCount = m_lightCount % MAX_LIGHTS;
+}
+
+bool RenderContext::useProgram(ShaderProgram& prog) {
+	if (m_state.program == &prog) {
+		m_stats.redundant++;
+		return false;
+	}
+	prog.use();
+	m_state.program = &prog;
+	// Uniforms belong to the program, the new one has whatever it was last given
+	m_state.modelValid = false;
+	m_stats.programChanges++;
+	return true;
+}
+
+void RenderContext::bindTexture(GLenum target, GLuint id, TextureSlot slot) {
+	// Names are unique across targets, a stale entry only costs a rebind
+	if (m_state.textures[slot] == id) {
+		m_stats.redundant++;
+		return;
+	}
+	glActiveTexture(GL_TEXTURE0 + slot);
+	glBindTexture(target, id);
+	m_state.textures[slot] = id;
+	m_stats.textureBinds++;
+}
+
+const glm::mat4& RenderContext::modelMatrix(u32 matrix) const {
+	return matrix == NO_TRANSFORM ? Identity : m_commands.matrices[matrix];
+}
+
+void RenderContext::setModelMatrix(u32 matrix) {
+	const glm::mat4& model = modelMatrix(matrix);
+	if (m_state.modelValid && m_state.model == model) {
+		m_stats.redundant++;
+		return;
+	}
+	m_state.program->get("uModel").set(model);
+	m_state.model = model;
+	m_state.modelValid = true;
+	m_stats.uniformUpdates++;
+}
+
+void RenderContext::setFrameUniforms(ShaderProgram& shader, u32 features, const Array<Light, MAX_LIGHTS>& lights, const u32 counts[3]) {
+	auto set = [&](const String& name, const auto& value) {
+		shader.get(name).set(value);
+		m_stats.uniformUpdates++;
+	};
+
+	set("uView", m_view);
+	set("uProj", m_projection);
+	set("uAmbient", m_ambient);
+
+	set("uColor", u32(SlotColor));
+	if (features & FeatureNormalMap) set("uNormal", u32(SlotNormal));
+	if (features & FeatureSpecularMap) set("uSpecular", u32(SlotSpecular));
+	if (features & FeatureEnvironment) set("uEnv", u32(SlotEnvironment));
+
+	const char* countNames[] = { "uSunCount", "uPointCount", "uSpotCount" };
+	u32 lightCount = 0;
+	for (u32 t = 0; t < 3; t++) {
+		if (counts[t] > 0) {
+			set(countNames[t], counts[t]);
+		}
+		lightCount += counts[t];
+	}
+
+	for (u32 i = 0; i < lightCount; i++) {
+		const Light& li = lights[i];
+		FixedString<32> light;
+		light.write("uLights[", i, "].");
+		const size_t prefix = light.size();
+		auto field = [&](const char* name) -> const String& {
+			m_uniformName.assign(light.c_str(), prefix);
+			m_uniformName += name;
+			return m_uniformName;
+		};
+		// Only the fields the type's loop reads, the others may be optimized out
+		set(field("color"), li.color);
+		set(field("intensity"), li.intensity);
+		if (li.type != Light::Sun) {
+			set(field("position"), li.position);
+			set(field("radius"), li.radius);
+		}
+		if (li.type != Light::Point) {
+			set(field("direction"), li.direction);
+		}
+		if (li.type == Light::Spot) {
+			set(field("spotCutoff"), li.spotCutoff);
+		}
+	}
+}
+
+u64 RenderContext::sortKey(const Drawable& d, u32 index) {
+	const u64 features = d.features;
+
+	// Ids of the three textures, numbered per frame in order of appearance
+	const u64 textures = u64(d.color) | (u64(d.normal) << 21) | (u64(d.specular) << 42);
+	auto it = m_textureSets.find(textures);
+	if (it == m_textureSets.end()) {
+		it = m_textureSets.insert({ textures, u32(m_textureSets.size()) }).first;
+	}
+	const u64 textureSet = it->second & 0xFFF;
+
+	// Positive floats order like their bit patterns, and never set the sign bit,
+	// so the top 23 of the remaining 31 bits are enough
+	const float depth = glm::max(-(m_view * glm::vec4(d.origin, 1.0f)).z, 0.0f);
+	u32 bits;
+	std::memcpy(&bits, &depth, sizeof(bits));
+	const u64 depthKey = bits >> 8;
+
+	if (d.translucent) {
+		return (1ULL << 63) | ((0x7FFFFFULL - depthKey) << 40) | (features << 32) | (textureSet << 20) | index;
+	}
+	return (features << 55) | (textureSet << 43) | (depthKey << 20) | index;
+}
+
+u32 RenderContext::textureFeatures(Texture2D normal, Texture2D specular) {
+	u32 features = 0;
+	if (normal.id() > 0) features |= FeatureNormalMap;
+	if (specular.id() > 0) features |= FeatureSpecularMap;
+	return features;
+}
+
 void RenderContext::submit(
 	const Mesh& mesh,
 	const glm::mat4& modelMatrix,
@@ -138,15 +407,20 @@ void RenderContext::submit(
 	Texture2D specular)
 {
 	Drawable d{};
-	d.color = color;
-	d.normal = normal;
-	d.specular = specular;
-	d.transform = true;
-	d.modelMatrix = modelMatrix;
-	d.vertices = mesh.vertices();
-	d.indices = mesh.indices();
-
-	m_drawables.push_back(d);
+	d.color = color.id();
+	d.normal = normal.id();
+	d.specular = specular.id();
+	d.features = textureFeatures(normal, specular);
+	submitMesh(mesh, modelMatrix, d, 0.0f);
+}
+
+void RenderContext::submit(const Mesh& mesh, const glm::mat4& modelMatrix, const Material& material) {
+	Drawable d{};
+	d.color = material.color;
+	d.normal = material.normal;
+	d.specular = material.specular;
+	d.features = FeatureTextureArray | FeatureNormalMap | FeatureSpecularMap;
+	submitMesh(mesh, modelMatrix, d, float(material.layer));
 }
 
 void RenderContext::submitSprite(
@@ -155,15 +429,77 @@ void RenderContext::submitSprite(
 	Texture2D specular,
 	glm::vec4 vcolor)
 {
-	glm::vec4 region = m_cursor.m_region;
-	glm::vec3 pos = m_cursor.m_position;
-	glm::vec3 ori = m_cursor.m_origin;
-	glm::vec2 scale = m_cursor.m_scale;
-	float rotation = m_cursor.m_rotation;
+	Drawable d{};
+	d.color = color.id();
+	d.normal = normal.id();
+	d.specular = specular.id();
+	d.features = textureFeatures(normal, specular);
+	submitQuad(color.width(), color.height(), color.region(), d, 0.0f, vcolor);
+}
 
-	float asp = float(color.width()) / float(color.height());
-	float w = color.width() >= color.height() ? 1.0f : asp;
-	float h = color.height() >= color.width() ? 1.0f : asp;
+void RenderContext::submitSprite(const Material& material, glm::vec4 vcolor) {
+	Drawable d{};
+	d.color = material.color;
+	d.normal = material.normal;
+	d.specular = material.specular;
+	d.features = FeatureTextureArray | FeatureNormalMap | FeatureSpecularMap;
+	submitQuad(material.width, material.height, glm::vec4(0, 0, 1, 1), d, float(material.layer), vcolor);
+}
+
+void RenderContext::submitMesh(const Mesh& mesh, const glm::mat4& modelMatrix, Drawable d, float layer) {
+	CommandBuffer& cb = commands();
+	if (cb.drawables.size() > DRAWABLE_INDEX_MASK) {
+		LogWarning("Too many drawables this pass, mesh skipped");
+		return;
+	}
+
+	// Corners of the local bounding box
+	const Vec<Vertex>& verts = mesh.vertices();
+	if (!verts.empty()) {
+		const glm::vec3& lo = mesh.boundsMin();
+		const glm::vec3& hi = mesh.boundsMax();
+		glm::vec3 corners[8];
+		for (u32 i = 0; i < 8; i++) {
+			glm::vec3 c((i & 1) ? hi.x : lo.x, (i & 2) ? hi.y : lo.y, (i & 4) ? hi.z : lo.z);
+			corners[i] = glm::vec3(modelMatrix * glm::vec4(c, 1.0f));
+		}
+		if (!visible(corners, 8)) {
+			cb.culled++;
+			return;
+		}
+	}
+
+	if (fitsCompact(verts, layer)) {
+		d.features |= FeatureCompactVertex;
+	}
+
+	d.origin = glm::vec3(modelMatrix[3]);
+	d.vertexOffset = u32(cb.vertices.size());
+	d.indexOffset = u32(cb.indices.size());
+	d.indexCount = u32(mesh.indices().size());
+	d.matrix = u32(cb.matrices.size());
+	d.translucent = false;
+
+	cb.matrices.push_back(modelMatrix);
+	cb.vertices.insert(cb.vertices.end(), verts.begin(), verts.end());
+	for (u32 i = d.vertexOffset; i < cb.vertices.size(); i++) {
+		cb.vertices[i].layer = layer;
+	}
+	cb.indices.insert(cb.indices.end(), mesh.indices().begin(), mesh.indices().end());
+	cb.drawables.push_back(d);
+}
+
+Mesh Cursor::quad(u32 width, u32 height, const glm::vec4& texRegion, float layer, const glm::vec4& vcolor) const {
+	glm::vec4 region = glm::vec4(
+		texRegion.x + m_region.x * texRegion.z,
+		texRegion.y + m_region.y * texRegion.w,
+		m_region.z * texRegion.z,
+		m_region.w * texRegion.w
+	);
+
+	float asp = float(width) / float(height);
+	float w = width >= height ? 1.0f : asp;
+	float h = height >= width ? 1.0f : asp;
 
 	float u0 = region.x;
 	float u1 = region.x + region.z;
@@ -171,42 +507,70 @@ void RenderContext::submitSprite(
 	float v1 = region.y + region.w;
 
 	Vertex verts[] = {
-		{ { 0, 0, 0 },  { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f }, { u0, v1 }, vcolor },
-		{ { w, 0, 0 },  { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f }, { u1, v1 }, vcolor },
-		{ { w, h, 0 },  { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f }, { u1, v0 }, vcolor },
-		{ { 0, h, 0 },  { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f }, { u0, v0 }, vcolor }
+		{ { 0, 0, 0 },  { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f }, { u0, v1 }, vcolor, layer },
+		{ { w, 0, 0 },  { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f }, { u1, v1 }, vcolor, layer },
+		{ { w, h, 0 },  { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f }, { u1, v0 }, vcolor, layer },
+		{ { 0, h, 0 },  { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f }, { u0, v0 }, vcolor, layer }
 	};
 	u32 inds[] = { 0, 1, 2, 0, 2, 3 };
 
 	for (Vertex& v : verts) {
-		v.position -= ori * glm::vec3(w, h, 1.0f);
+		v.position -= m_origin * glm::vec3(w, h, 1.0f);
 	}
 
 	Mesh spr{};
 	spr.vertices(ToVector(Vertex, verts));
 	spr.indices(ToVector(u32, inds));
 
-	glm::mat4 T = glm::translate(glm::mat4(1.0f), pos);
-	if (rotation != 0.0f) {
-		T *= glm::rotate(glm::mat4(1.0f), rotation, glm::vec3(0, 0, 1));
+	glm::mat4 T = glm::translate(glm::mat4(1.0f), m_position);
+	if (m_rotation != 0.0f) {
+		T *= glm::rotate(glm::mat4(1.0f), m_rotation, glm::vec3(0, 0, 1));
 	}
-	if (scale.x != 1.0f || scale.y != 1.0f) {
-		T *= glm::scale(glm::mat4(1.0f), glm::vec3(scale, 1.0f));
+	if (m_scale.x != 1.0f || m_scale.y != 1.0f) {
+		T *= glm::scale(glm::mat4(1.0f), glm::vec3(m_scale, 1.0f));
 	}
 
 	spr.transform(T);
 	spr.calculateTangents();
+	return spr;
+}
 
-	Drawable d{};
-	d.color = color;
-	d.normal = normal;
-	d.specular = specular;
-	d.transform = false;
-	d.modelMatrix = glm::mat4(1.0f);
-	d.vertices = spr.vertices();
-	d.indices = spr.indices();
-
-	m_drawables.push_back(d);
+void RenderContext::submitQuad(u32 width, u32 height, const glm::vec4& texRegion, Drawable d, float layer, const glm::vec4& vcolor) {
+	CommandBuffer& cb = commands();
+	if (cb.drawables.size() > DRAWABLE_INDEX_MASK) {
+		LogWarning("Too many drawables this pass, sprite skipped");
+		return;
+	}
+
+	Mesh spr = cb.cursor.quad(width, height, texRegion, layer, vcolor);
+
+	glm::vec3 corners[4];
+	for (u32 i = 0; i < 4; i++) {
+		corners[i] = spr.vertices()[i].position;
+	}
+	if (!visible(corners, 4)) {
+		cb.culled++;
+		return;
+	}
+
+	if (fitsCompact(spr.vertices(), layer)) {
+		d.features |= FeatureCompactVertex;
+	}
+
+	d.origin = cb.cursor.m_position;
+	d.vertexOffset = u32(cb.vertices.size());
+	d.indexOffset = u32(cb.indices.size());
+	d.indexCount = u32(spr.indices().size());
+	d.matrix = NO_TRANSFORM;
+	d.translucent = vcolor.a < 1.0f;
+
+	cb.vertices.insert(cb.vertices.end(), spr.vertices().begin(), spr.vertices().end());
+	cb.indices.insert(cb.indices.end(), spr.indices().begin(), spr.indices().end());
+	cb.drawables.push_back(d);
+}
+
+void RenderContext::submit(StaticGeometry& geometry) {
+	m_staticGeometry.push_back(&geometry);
 }
 
 void RenderContext::submitSunLight(
@@ -214,13 +578,12 @@ void RenderContext::submitSunLight(
 	const glm::vec3& color,
 	float intensity)
 {
-	Light& light = m_lights[m_lightCount % MAX_LIGHTS];
+	Light light{};
 	light.type = Light::Sun;
 	light.color = color;
 	light.direction = direction;
 	light.intensity = intensity;
-	m_lightCount++;
-	m_lightCount = m_lightCount % MAX_LIGHTS;
+	commands().lights.push_back(light);
 }
 
 void RenderContext::submitPointLight(
@@ -229,14 +592,13 @@ void RenderContext::submitPointLight(
 	float intensity,
 	float radius) 
 {
-	Light& light = m_lights[m_lightCount % MAX_LIGHTS];
+	Light light{};
 	light.type = Light::Point;
 	light.position = position;
 	light.color = color;
 	light.intensity = intensity;
 	light.radius = radius;
-	m_lightCount++;
-	m_lightCount = m_lightCount % MAX_LIGHTS;
+	commands().lights.push_back(light);
 }
 
 void RenderContext::submitSpotLight(
@@ -247,7 +609,7 @@ void RenderContext::submitSpotLight(
 	float radius,
 	float cutOff)
 {
-	Light& light = m_lights[m_lightCount % MAX_LIGHTS];
+	Light light{};
 	light.type = Light::Spot;
 	light.position = position;
 	light.direction = direction;
@@ -255,79 +617,115 @@ void RenderContext::submitSpotLight(
 	light.intensity = intensity;
 	light.radius = radius;
 	light.spotCutoff = cutOff;
-	m_lightCount++;
-	m_lightCount = m_lightCount % MAX_LIGHTS;
+	commands().lights.push_back(light);
 }
 
 void RenderContext::updateBufferData() {
-	if (m_drawables.empty()) return;
+	ProfileZone("updateBufferData");
+	if (m_commands.drawables.empty()) return;
 
-	std::sort(
-		m_drawables.begin(), m_drawables.end(),
-		[](const Drawable& a, const Drawable& b) -> bool {
-			return a.color.id() < b.color.id();
+	m_textureSets.clear();
+	m_keys.resize(m_commands.drawables.size());
+	for (u32 i = 0; i < m_commands.drawables.size(); i++) {
+		m_keys[i] = sortKey(m_commands.drawables[i], i);
+	}
+	Utils::radixSort(m_keys, m_sortScratch);
+
+	// Vertices go out in batch order, each batch indexing from its first one
+	m_streamVertices.clear();
+	m_compactVertices.clear();
+	m_indices.clear();
+	m_indices.reserve(m_commands.indices.size());
+	for (u64 key : m_keys) {
+		const Drawable& d = m_commands.drawables[key & DRAWABLE_INDEX_MASK];
+		const bool compact = (d.features & FeatureCompactVertex) != 0;
+		const u32 streamSize = u32(compact ? m_compactVertices.size() : m_streamVertices.size());
+
+		Batch* last = m_batches.empty() ? nullptr : &m_batches.back();
+		if (last &&
+			last->color == d.color &&
+			last->normal == d.normal &&
+			last->specular == d.specular &&
+			last->features == d.features &&
+			(last->matrix == d.matrix || modelMatrix(last->matrix) == modelMatrix(d.matrix)))
+		{
+			last->length += d.indexCount;
+		} else {
+			m_batches.push_back({
+				u32(m_indices.size()), d.indexCount, d.matrix,
+				d.color, d.normal, d.specular,
+				d.features, streamSize
+			});
+			last = &m_batches.back();
 		}
-	);
-
-	Vec<Vertex> vertices;
-	Vec<u32> indices;
 
-	Drawable first = m_drawables[0];
-	vertices.insert(vertices.end(), first.vertices.begin(), first.vertices.end());
-	indices.insert(indices.end(), first.indices.begin(), first.indices.end());
-
-	m_batches.emplace_back(
-		first.modelMatrix,
-		0,
-		first.indices.size(),
-		first.color, first.normal, first.specular,
-		first.transform
-	);
+		// Vertex count is not stored, the highest index tells where the drawable ends
+		const u32* src = m_commands.indices.data() + d.indexOffset;
+		u32 vertexCount = 0;
+		const u32 base = streamSize - last->baseVertex;
+		for (u32 i = 0; i < d.indexCount; i++) {
+			m_indices.push_back(src[i] + base);
+			vertexCount = std::max(vertexCount, src[i] + 1);
+		}
 
-	u32 offset = 0;
-	u32 indexOffset = first.vertices.size();
+		const Vertex* verts = m_commands.vertices.data() + d.vertexOffset;
+		if (compact) {
+			m_compactVertices.insert(m_compactVertices.end(), verts, verts + vertexCount);
+		} else {
+			m_streamVertices.insert(m_streamVertices.end(), verts, verts + vertexCount);
+		}
+	}
 
-	for (u32 i = 1; i < m_drawables.size(); i++) {
-		Drawable prev = m_drawables[i - 1];
-		Drawable curr = m_drawables[i];
-		if (prev.color.id() != curr.color.id() ||
-			prev.normal.id() != curr.normal.id() ||
-			prev.specular.id() != curr.specular.id() ||
-			prev.transform != curr.transform)
-		{
-			offset += m_batches.back().length;
-			m_batches.emplace_back(
-				curr.modelMatrix,
-				offset,
-				curr.indices.size(),
-				curr.color, curr.normal, curr.specular,
-				curr.transform
-			);
+	// Batches of at most 65536 vertices take 16 bit indices, stored after the 32 bit ones.
+	// Wide ones are packed down in place, never over indices not read yet.
+	u32 wideCount = 0;
+	m_narrowIndices.clear();
+	for (Batch& b : m_batches) {
+		const u32* src = m_indices.data() + b.offset;
+		const u32 vertexCount = b.length > 0 ? *std::max_element(src, src + b.length) + 1 : 0;
+		if (vertexCount <= 0x10000) {
+			b.offset = u32(m_narrowIndices.size());
+			b.indexType = GL_UNSIGNED_SHORT;
+			for (u32 i = 0; i < b.length; i++) {
+				m_narrowIndices.push_back(u16(src[i]));
+			}
 		} else {
-			m_batches.back().length += u32(curr.indices.size());
+			if (b.offset != wideCount) {
+				std::copy(src, src + b.length, m_indices.data() + wideCount);
+			}
+			b.offset = wideCount;
+			b.indexType = GL_UNSIGNED_INT;
+			wideCount += b.length;
+		}
+	}
+	for (Batch& b : m_batches) {
+		if (b.indexType == GL_UNSIGNED_SHORT) {
+			b.offset += wideCount * 2;
 		}
+	}
 
-		vertices.insert(vertices.end(), curr.vertices.begin(), curr.vertices.end());
-		for (u32 id : curr.indices) {
-			indices.push_back(id + indexOffset);
+	auto upload = [&](GLenum target, u32& capacity, const void* data, u32 bytes, u32 offset, u32 total) {
+		if (total > capacity) {
+			glBufferData(target, total, nullptr, GL_DYNAMIC_DRAW);
+			capacity = total;
+		}
+		if (bytes > 0) {
+			glBufferSubData(target, offset, bytes, data);
 		}
+		m_stats.uploadBytes += bytes;
+	};
 
-		indexOffset += u32(curr.vertices.size());
-	}
+	const u32 vertexBytes = u32(m_streamVertices.size() * sizeof(Vertex));
+	const u32 compactBytes = u32(m_compactVertices.size() * sizeof(CompactVertex));
+	const u32 wideBytes = wideCount * u32(sizeof(u32));
+	const u32 narrowBytes = u32(m_narrowIndices.size() * sizeof(u16));
 
 	glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
-	if (vertices.size() > m_vboSize) {
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_DYNAMIC_DRAW);
-		m_vboSize = vertices.size();
-	} else {
-		glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(Vertex), vertices.data());
-	}
+	upload(GL_ARRAY_BUFFER, m_vboSize, m_streamVertices.data(), vertexBytes, 0, vertexBytes);
+	glBindBuffer(GL_ARRAY_BUFFER, m_compactVbo);
+	upload(GL_ARRAY_BUFFER, m_compactVboSize, m_compactVertices.data(), compactBytes, 0, compactBytes);
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo);
-	if (indices.size() > m_eboSize) {
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(u32), indices.data(), GL_DYNAMIC_DRAW);
-		m_eboSize = indices.size();
-	} else {
-		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indices.size() * sizeof(u32), indices.data());
-	}
+	upload(GL_ELEMENT_ARRAY_BUFFER, m_eboSize, m_indices.data(), wideBytes, 0, wideBytes + narrowBytes);
+	upload(GL_ELEMENT_ARRAY_BUFFER, m_eboSize, m_narrowIndices.data(), narrowBytes, wideBytes, wideBytes + narrowBytes);
 }
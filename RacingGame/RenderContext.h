@@ -7,13 +7,18 @@
 #include "ShaderProgram.h"
 #include "Mesh.h"
 #include "Texture.h"
+#include "Material.h"
 
 #include "glad.h"
 #include "glm/vec2.hpp"
 #include "glm/vec3.hpp"
 
+#include <functional>
+
 #define MAX_LIGHTS 32
 
+class StaticGeometry;
+
 struct Light {
 	enum LightType {
 		Disabled = 0,
@@ -31,35 +36,55 @@ struct Light {
 	LightType type;
 };
 
+#define NO_TRANSFORM 0xFFFFFFFF
+
+// Geometry lives in the context's staging arrays, this only points into them
 struct Drawable {
-	bool transform;
-	glm::mat4 modelMatrix;
-	Vec<Vertex> vertices;
-	Vec<u32> indices;
-	Texture2D color, normal, specular;
+	glm::vec3 origin;
+	u32 vertexOffset;
+	u32 indexOffset, indexCount;
+	u32 matrix; // into the frame's matrices, or NO_TRANSFORM
+	bool translucent;
+	GLuint color, normal, specular; // array textures with FeatureTextureArray
+	u32 features;
 };
 
 struct Batch {
-	bool transform;
-	glm::mat4 modelMatrix;
-	u32 offset, length;
-	Texture2D color, normal, specular;
-
-	Batch() = default;
-	Batch(const glm::mat4& m, u32 off, u32 len, Texture2D col, Texture2D nrm, Texture2D spc, bool xform)
-		: modelMatrix(m), offset(off), length(len), color(col), normal(nrm), specular(spc), transform(xform)
-	{}
+	u32 offset, length; // in indices of indexType
+	u32 matrix;
+	GLuint color, normal, specular;
+	u32 features;
+	u32 baseVertex{ 0 };
+	GLenum indexType{ GL_UNSIGNED_INT };
+};
+
+// Counted over every begin()/end() pass of a frame
+struct RenderStats {
+	u32 drawCalls;
+	u32 programChanges;
+	u32 textureBinds;
+	u32 uniformUpdates;
+	u32 redundant; // binds and uniform sets the state cache filtered out
+	u32 culled; // drawables outside the view frustum
+	u32 uploadBytes; // vertex and index data sent to GL
+
+	u32 stateChanges() const { return programChanges + textureBinds + uniformUpdates; }
 };
 
 struct Cursor {
 	friend class RenderContext;
+	friend class StaticGeometry;
 
 	Cursor& position(const glm::vec3& v) { m_position = v; return *this; }
 	Cursor& scale(const glm::vec2& v) { m_scale = v; return *this; }
 	Cursor& origin(const glm::vec3& v) { m_origin = v; return *this; }
 	Cursor& rotation(float v) { m_rotation = v; return *this; }
+	// Relative to the texture's own region, so it also works for atlas textures
 	Cursor& region(const glm::vec4& v) { m_region = v; return *this; }
 
+	// Sprite quad for a texture of the given size, already placed by the cursor
+	Mesh quad(u32 width, u32 height, const glm::vec4& texRegion, float layer, const glm::vec4& vcolor) const;
+
 protected:
 	glm::vec4 m_region{ 0, 0, 1, 1 };
 	glm::vec3 m_position{ 0, 0, 0 }, m_origin{ 0.5f, 0.5f, 0.5f };
@@ -67,11 +92,49 @@ protected:
 	float m_rotation{ 0 };
 };
 
+// Submissions of one job, merged into the pass by RenderContext::end()
+struct CommandBuffer {
+	Vec<Drawable> drawables;
+	Vec<glm::mat4> matrices;
+	Vec<Vertex> vertices;
+	Vec<u32> indices;
+	Vec<Light> lights;
+	Cursor cursor;
+	u32 culled;
+
+	void clear() {
+		drawables.clear();
+		matrices.clear();
+		vertices.clear();
+		indices.clear();
+		lights.clear();
+		culled = 0;
+	}
+};
+
 class RenderContext {
 public:
+	// Uber shader permutation bits, each compiles out a runtime branch in uber.frag
+	enum ShaderFeature {
+		FeatureNormalMap = 1 << 0,
+		FeatureSpecularMap = 1 << 1,
+		FeatureEnvironment = 1 << 2,
+		FeatureSunLights = 1 << 3,
+		FeaturePointLights = 1 << 4,
+		FeatureSpotLights = 1 << 5,
+		FeatureTextureArray = 1 << 6,
+		FeatureCompactVertex = 1 << 7 // picked per drawable, see CompactVertex
+	};
+
 	RenderContext();
 	~RenderContext();
 
+	// Normal and specular map bits for a set of plain textures
+	static u32 textureFeatures(Texture2D normal, Texture2D specular);
+
+	// Starts counting a new frame, stats() then returns the one before
+	void beginFrame();
+
 	void begin();
 	void end();
 
@@ -90,6 +153,19 @@ public:
 		glm::vec4 vcolor = glm::vec4(1)
 	);
 
+	// Materials from the same library page batch together whatever their layer
+	void submit(const Mesh& mesh, const glm::mat4& modelMatrix, const Material& material);
+	void submitSprite(const Material& material, glm::vec4 vcolor = glm::vec4(1));
+
+	// Drawn from its own buffers, one call per material, before this pass' batches
+	void submit(StaticGeometry& geometry);
+
+	// Calls fn(i) for every i in [0, count) on the thread pool. Anything fn submits
+	// goes to a command buffer of its job, and end() merges those in job order, so
+	// the pass comes out the same however the jobs were scheduled.
+	// fn must not change projection, view or anything else shared.
+	void parallelSubmit(u32 count, const std::function<void(u32)>& fn);
+
 	void submitSunLight(const glm::vec3& direction, const glm::vec3& color, float intensity);
 	void submitPointLight(const glm::vec3& position, const glm::vec3& color, float intensity, float radius);
 	void submitSpotLight(
@@ -102,10 +178,10 @@ public:
 	);
 
 	glm::mat4 projection() const { return m_projection; }
-	void projection(const glm::mat4& vp) { m_projection = vp;  }
+	void projection(const glm::mat4& vp) { m_projection = vp; updateFrustum(); }
 
 	glm::mat4 view() const { return m_view; }
-	void view(const glm::mat4& vp) { m_view = vp; }
+	void view(const glm::mat4& vp) { m_view = vp; updateFrustum(); }
 
 	glm::vec3 ambient() const { return m_ambient; }
 	void ambient(const glm::vec3& a) { m_ambient = a; }
@@ -113,26 +189,105 @@ public:
 	Texture2D environment() const { m_environment; }
 	void environment(const Texture2D& tex) { m_environment = tex;  }
 
-	Cursor& cursor() { return m_cursor; }
+	Cursor& cursor() { return commands().cursor; }
+
+	// How far rendering is between the previous and the current simulation tick [0, 1)
+	float alpha() const { return m_alpha; }
+	void alpha(float a) { m_alpha = a; }
+
+	const RenderStats& stats() const { return m_frameStats; }
 
 private:
-	Vec<Drawable> m_drawables;
+	// Fixed texture units, so sampler uniforms only change with the program
+	enum TextureSlot {
+		SlotEnvironment = 0,
+		SlotColor,
+		SlotNormal,
+		SlotSpecular,
+		SlotCount
+	};
+
+	// What we last told GL, anything else may have touched it between passes
+	struct StateCache {
+		ShaderProgram* program;
+		Vec<ShaderProgram*> framePrograms; // have this pass' frame uniforms
+		Array<GLuint, SlotCount> textures;
+		glm::mat4 model; // uModel of the bound program
+		bool modelValid;
+
+		void reset() {
+			program = nullptr;
+			framePrograms.clear();
+			textures.fill(0xFFFFFFFF);
+			modelValid = false;
+		}
+	};
+
+	// Submissions from the calling thread, and the job buffers merged into it
+	CommandBuffer m_commands;
+	Vec<UPtr<CommandBuffer>> m_jobCommands;
+	u32 m_jobCount;
+
+	// Vertices are copied out per batch, so each batch can use 16 bit indices
+	// from its own base vertex when it has few enough
+	Vec<Vertex> m_streamVertices;
+	Vec<CompactVertex> m_compactVertices;
+	Vec<u32> m_indices;
+	Vec<u16> m_narrowIndices;
+	Vec<u64> m_keys, m_sortScratch;
+	UMap<u64, u32> m_textureSets;
 	Vec<Batch> m_batches;
+	Vec<StaticGeometry*> m_staticGeometry;
+
+	StateCache m_state;
+	RenderStats m_stats, m_frameStats;
 
 	Array<Light, MAX_LIGHTS> m_lights;
 	u32 m_lightCount;
 	glm::vec3 m_ambient;
 
-	GLuint m_vbo, m_ebo, m_vao;
-	u32 m_vboSize, m_eboSize;
+	GLuint m_vbo, m_compactVbo, m_ebo, m_vao, m_compactVao;
+	u32 m_vboSize, m_compactVboSize, m_eboSize; // in bytes
 
-	ShaderProgram m_shader;
+	ShaderPermutations m_shaders;
 	Texture2D m_environment;
-	Cursor m_cursor;
 
 	glm::mat4 m_projection, m_view;
+	Array<glm::vec4, 6> m_frustum; // planes, inside is dot(plane, (p, 1)) >= 0
+	float m_alpha;
+
+	// Reused for uniform names, keeps its capacity between frames
+	String m_uniformName;
 
 	void updateBufferData();
+
+	// Buffer of the job running on this thread, m_commands outside of jobs
+	CommandBuffer& commands();
+	void mergeJobCommands();
+
+	void updateFrustum();
+	// False if every point is outside the same frustum plane
+	bool visible(const glm::vec3* points, u32 count) const;
+
+	void addLight(const Light& light);
+
+	void submitMesh(const Mesh& mesh, const glm::mat4& modelMatrix, Drawable d, float layer);
+	void submitQuad(u32 width, u32 height, const glm::vec4& texRegion, Drawable d, float layer, const glm::vec4& vcolor);
+
+	// Per frame state set once for every permutation used
+	void setFrameUniforms(ShaderProgram& shader, u32 features, const Array<Light, MAX_LIGHTS>& lights, const u32 counts[3]);
+
+	// Go through the state cache
+	bool useProgram(ShaderProgram& prog);
+	void bindTexture(GLenum target, GLuint id, TextureSlot slot);
+	void setModelMatrix(u32 matrix);
+
+	const glm::mat4& modelMatrix(u32 matrix) const;
+
+	// Opaque: features (8 bits), texture set (12), depth front to back (23)
+	// Translucent: depth back to front, features, texture set
+	// The low bits hold the drawable index, keeping submit order for ties
+	u64 sortKey(const Drawable& d, u32 index);
 };
 
 #endif // RENDER_CONTEXT_H
\ No newline at end of file
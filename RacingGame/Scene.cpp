@@ -1,13 +1,14 @@
 #include "Scene.h"
 
 #include "Logger.h"
+#include "Profiler.h"
 
 Scene::~Scene() {
 	
 }
 
 Scene::Scene() {
-	
+	m_seed = u64(rand());
 }
 
 void Scene::update(float dt) {
@@ -16,37 +17,113 @@ void Scene::update(float dt) {
 	}
 	m_addList.clear();
 
-	m_physicsWorld->Step(dt, 10, 5);
+	{
+		ProfileZone("PhysicsStep");
+		m_physicsWorld->Step(dt, 10, 5);
+	}
+	{
+		ProfileZone("Contacts");
+		dispatchContacts();
+	}
 
-	Vec<u32> m_dead;
-	u32 i = 0;
-	for (auto&& obj : m_objects) {
-		obj->update(dt);
-		if (obj->m_dead) {
-			m_dead.push_back(i);
+	{
+		ProfileZone("Objects");
+		for (auto&& obj : m_objects) {
+			obj->update(dt);
+		}
+	}
+
+	// The last published snapshot may still reference dead objects
+	for (auto it = m_objects.begin(); it != m_objects.end();) {
+		if ((*it)->m_dead) {
+			m_graveyard.push_back({ m_tick, std::move(*it) });
+			it = m_objects.erase(it);
+		} else {
+			++it;
 		}
-		i++;
 	}
 
-	for (u32 id : m_dead) {
-		m_objects.erase(m_objects.begin() + id);
+#ifdef _DEBUG
+	// Recorded per tick like the rest of the debug lines (see Engine::tick)
+	if (DebugDraw::get().enabled(DebugPhysics)) {
+		m_physicsWorld->DrawDebugData();
 	}
+#endif
+
+	publishSnapshot();
 }
 
-void Scene::render(RenderContext *context) {
+void Scene::publishSnapshot() {
+	RenderSnapshot& snap = m_snapshots.write();
+	snap.tick = m_tick;
+	snap.objects.clear();
 	for (auto&& obj : m_objects) {
-		obj->render(context);
+		ObjectRenderState state;
+		state.object = obj.get();
+		state.position = obj->blendedPosition(1.0f);
+		state.prevPosition = obj->blendedPosition(0.0f);
+		state.rotation = obj->blendedRotation(1.0f);
+		state.prevRotation = obj->blendedRotation(0.0f);
+		state.params = glm::vec4(0.0f);
+		obj->onSnapshot(state);
+		snap.objects.push_back(state);
 	}
+	m_snapshots.publish();
+}
 
-#ifdef _DEBUG
-	m_physicsWorld->DrawDebugData();
-#endif
+void Scene::collectGarbage(u64 renderedTick) {
+	auto end = std::remove_if(m_graveyard.begin(), m_graveyard.end(),
+		[renderedTick](const std::pair<u64, UPtr<GameObject>>& e) { return e.first < renderedTick; }
+	);
+	m_graveyard.erase(end, m_graveyard.end());
+}
+
+void Scene::render(RenderContext *context) {
+	ProfileZone("RenderSubmit");
+	m_snapshots.acquire();
+
+	const RenderSnapshot& snap = m_snapshots.read();
+	m_renderedTick = snap.tick;
+
+	context->submit(m_staticGeometry);
+
+	// Bind every entry first, parents are looked up through their own state
+	for (auto&& state : snap.objects) {
+		state.object->m_renderState = &state;
+	}
+	m_parallelRender.clear();
+	for (auto&& state : snap.objects) {
+		if (state.object->parallelRender()) {
+			m_parallelRender.push_back(state.object);
+		} else {
+			state.object->render(context);
+		}
+	}
+	context->parallelSubmit(u32(m_parallelRender.size()), [&](u32 i) {
+		m_parallelRender[i]->render(context);
+	});
 }
 
 void Scene::destroy() {
+	for (auto&& obj : m_objects) {
+		m_graveyard.push_back({ m_tick, std::move(obj) });
+	}
 	m_objects.clear();
+	publishSnapshot();
 	m_addList.clear();
+	m_staticGeometry.clear();
+	m_contactCount = 0;
+	m_nextId = 0;
+	m_lodFocus = nullptr;
 	m_debugDraw.release();
+	if (m_physicsWorld) {
+		b2AllocatorStats stats = m_physicsWorld->GetAllocatorStats();
+		LogInfo("Physics pools: ", stats.block.chunkCount, " chunks of ", stats.block.chunkSize,
+				" bytes, peak ", stats.block.maxBytesInUse, " bytes in blocks, ",
+				stats.block.liveMallocs, " large allocations live; stack peak ",
+				stats.stack.maxStackUsage, " of ", stats.stack.stackSize, " bytes, ",
+				stats.stack.mallocCount, " allocations spilled to the heap");
+	}
 	m_physicsWorld.release();
 }
 
@@ -54,11 +131,17 @@ void Scene::add(GameObject *obj) {
 	if (obj == nullptr) return;
 	obj->m_scene = this;
 	obj->m_firstTime = true;
+	obj->m_id = m_nextId++;
 	m_addList.push_back(UPtr<GameObject>(obj));
 }
 
 void Scene::BeginContact(b2Contact* contact) {
-	Collision col;
+	if (m_contactCount >= MAX_CONTACT_EVENTS) {
+		m_droppedContacts++;
+		return;
+	}
+
+	Collision& col = m_contacts[m_contactCount++];
 	col.objectA = static_cast<GameObject*>(contact->GetFixtureA()->GetBody()->GetUserData());
 	col.objectB = static_cast<GameObject*>(contact->GetFixtureB()->GetBody()->GetUserData());
 
@@ -67,17 +150,241 @@ void Scene::BeginContact(b2Contact* contact) {
 
 	col.normal = glm::vec2(n.x, n.y);
 	col.point = glm::vec2(p.x, p.y);
+}
 
-	for (auto&& b : col.objectA->m_behaviors) {
-		b->onCollide(col);
+void Scene::dispatchContacts() {
+	if (m_droppedContacts > 0) {
+		LogWarning("Contact buffer full, dropped ", m_droppedContacts, " events.");
+		m_droppedContacts = 0;
 	}
-	for (auto&& b : col.objectB->m_behaviors) {
-		b->onCollide(col);
+	if (m_contactCount == 0) return;
+
+	// Coalesce per pair: sort by the unordered pair of object ids (not addresses,
+	// so dispatch order is the same on every run) and keep the first event recorded
+	// for each pair. The sort must be stable for that to hold.
+	auto pairOf = [](const Collision& c) -> std::pair<u32, u32> {
+		return std::minmax(c.objectA->m_id, c.objectB->m_id);
+	};
+	auto begin = m_contacts.begin();
+	auto end = m_contacts.begin() + m_contactCount;
+	std::stable_sort(begin, end, [&](const Collision& a, const Collision& b) -> bool {
+		return pairOf(a) < pairOf(b);
+	});
+	end = std::unique(begin, end, [&](const Collision& a, const Collision& b) -> bool {
+		return pairOf(a) == pairOf(b);
+	});
+
+	for (auto it = begin; it != end; ++it) {
+		const Collision& col = *it;
+		for (auto&& b : col.objectA->m_behaviors) {
+			b->onCollide(col);
+		}
+		for (auto&& b : col.objectB->m_behaviors) {
+			b->onCollide(col);
+		}
 	}
+	m_contactCount = 0;
+}
+
+u64 Scene::stateHash() const {
+	u64 h = Utils::hash(nullptr, 0);
+	for (auto&& obj : m_objects) {
+		b2Body* body = obj->m_body;
+		if (body == nullptr) continue;
+
+		const b2Transform& xf = body->GetTransform();
+		b2Vec2 lv = body->GetLinearVelocity();
+		float av = body->GetAngularVelocity();
+
+		h = Utils::hash(&obj->m_id, sizeof(u32), h);
+		h = Utils::hash(&xf, sizeof(b2Transform), h);
+		h = Utils::hash(&lv, sizeof(b2Vec2), h);
+		h = Utils::hash(&av, sizeof(float), h);
+	}
+	return h;
+}
+
+#define SNAPSHOT_MAGIC 0x50414E53 // SNAP
+
+// Fixed part of an object section (id up to the body flag) and of its body state
+static const size_t SNAPSHOT_OBJECT_SIZE =
+	sizeof(u32) + sizeof(glm::vec3) + sizeof(glm::vec2) + sizeof(float) * 2 + sizeof(bool) * 3;
+static const size_t SNAPSHOT_BODY_SIZE = sizeof(b2Vec2) * 3 + sizeof(float) * 3 + sizeof(bool) * 2;
+
+static i32 fixtureIndex(b2Fixture* fixture) {
+	i32 i = 0;
+	for (b2Fixture* f = fixture->GetBody()->GetFixtureList(); f; f = f->GetNext(), i++) {
+		if (f == fixture) return i;
+	}
+	return -1;
+}
+
+void Scene::saveState(BinWriter& out) {
+	LogAssert(!m_physicsWorld->IsLocked(), "Cannot save the scene state during a physics step.");
+
+	out.writeAll(u32(SNAPSHOT_MAGIC), u32(m_objects.size()), m_random);
+
+	for (auto&& obj : m_objects) {
+		// Each object section is prefixed with its length, so restoreState
+		// can check the whole record before applying any of it
+		size_t section = out.dataSize();
+		out.write(u32(0));
+
+		out.writeAll(
+			obj->m_id, obj->m_position, obj->m_scale, obj->m_rotation, obj->m_life,
+			obj->m_firstTime, obj->m_dead, obj->m_body != nullptr
+		);
+		if (obj->m_body != nullptr) {
+			b2Body* body = obj->m_body;
+			out.writeAll(
+				body->GetPosition(), body->GetAngle(),
+				body->GetLinearVelocity(), body->GetAngularVelocity(),
+				body->GetForce(), body->GetTorque(),
+				body->IsAwake(), body->IsActive()
+			);
+		}
+		for (auto&& b : obj->m_behaviors) {
+			b->onSave(out);
+		}
+		out.writeAt(section, u32(out.dataSize() - section - sizeof(u32)));
+	}
+
+	u32 contactCount = 0;
+	for (b2Contact* c = m_physicsWorld->GetContactList(); c; c = c->GetNext()) {
+		contactCount++;
+	}
+	out.write(contactCount);
+
+	for (b2Contact* c = m_physicsWorld->GetContactList(); c; c = c->GetNext()) {
+		ContactState cs{};
+		cs.objectA = static_cast<GameObject*>(c->GetFixtureA()->GetBody()->GetUserData())->m_id;
+		cs.objectB = static_cast<GameObject*>(c->GetFixtureB()->GetBody()->GetUserData())->m_id;
+		cs.fixtureA = fixtureIndex(c->GetFixtureA());
+		cs.fixtureB = fixtureIndex(c->GetFixtureB());
+		cs.childA = c->GetChildIndexA();
+		cs.childB = c->GetChildIndexB();
+		cs.manifold = *c->GetManifold();
+		out.write(cs);
+	}
+}
+
+bool Scene::restoreState(u8* data, size_t size) {
+	LogAssert(!m_physicsWorld->IsLocked(), "Cannot restore the scene state during a physics step.");
+
+	if (!validateState(data, size)) {
+		LogError("Snapshot does not match the scene.");
+		return false;
+	}
+
+	BinReader in(data);
+	in.skip(sizeof(u32) * 2);
+	m_random = in.read<Random>();
+
+	for (auto&& obj : m_objects) {
+		u32 length = in.read<u32>();
+		u8* sectionEnd = in.position() + length;
+
+		in.skip(sizeof(u32)); // id, checked by validateState
+		obj->m_position = in.read<glm::vec3>();
+		obj->m_scale = in.read<glm::vec2>();
+		obj->m_rotation = in.read<float>();
+		obj->m_life = in.read<float>();
+		obj->m_firstTime = in.read<bool>();
+		obj->m_dead = in.read<bool>();
+		obj->m_prevPosition = obj->m_position;
+		obj->m_prevRotation = obj->m_rotation;
+
+		if (in.read<bool>()) {
+			b2Vec2 pos = in.read<b2Vec2>();
+			float angle = in.read<float>();
+			b2Vec2 lv = in.read<b2Vec2>();
+			float av = in.read<float>();
+			b2Vec2 force = in.read<b2Vec2>();
+			float torque = in.read<float>();
+			bool awake = in.read<bool>();
+			bool active = in.read<bool>();
+
+			b2Body* body = obj->m_body;
+			if (body != nullptr) {
+				body->SetActive(active);
+				body->SetTransform(pos, angle);
+				body->SetAwake(awake);
+				if (awake) {
+					body->SetLinearVelocity(lv);
+					body->SetAngularVelocity(av);
+					body->SetForce(force, torque);
+				}
+			}
+		}
+		for (auto&& b : obj->m_behaviors) {
+			b->onRestore(in);
+		}
+		LogAssert(in.position() == sectionEnd, "Behavior state restored with a different size than it was saved with.");
+	}
+
+	// Contacts that still exist get their manifold back, so the next step warm starts
+	// from the saved impulses. Missing ones are recreated by the broad-phase, and
+	// ones that did not exist at save time lose their points (and impulses).
+	u32 contactCount = in.read<u32>();
+	m_restoredContacts.clear();
+	for (u32 i = 0; i < contactCount; i++) {
+		m_restoredContacts.push_back(in.read<ContactState>());
+	}
+
+	for (b2Contact* c = m_physicsWorld->GetContactList(); c; c = c->GetNext()) {
+		u32 objA = static_cast<GameObject*>(c->GetFixtureA()->GetBody()->GetUserData())->m_id;
+		u32 objB = static_cast<GameObject*>(c->GetFixtureB()->GetBody()->GetUserData())->m_id;
+		i32 fixA = fixtureIndex(c->GetFixtureA());
+		i32 fixB = fixtureIndex(c->GetFixtureB());
+		bool saved = false;
+		for (auto&& cs : m_restoredContacts) {
+			if (cs.objectA == objA && cs.objectB == objB &&
+				cs.fixtureA == fixA && cs.fixtureB == fixB &&
+				cs.childA == c->GetChildIndexA() && cs.childB == c->GetChildIndexB())
+			{
+				*c->GetManifold() = cs.manifold;
+				saved = true;
+				break;
+			}
+		}
+		if (!saved) {
+			c->GetManifold()->pointCount = 0;
+		}
+	}
+	return true;
+}
+
+bool Scene::validateState(u8* data, size_t size) {
+	const u8* end = data + size;
+	BinReader in(data);
+	auto remaining = [&]() { return size_t(end - in.position()); };
+
+	if (size < sizeof(u32) * 2 + sizeof(Random)) return false;
+	if (in.read<u32>() != SNAPSHOT_MAGIC) return false;
+	if (in.read<u32>() != m_objects.size()) return false;
+	in.skip(sizeof(Random));
+
+	for (auto&& obj : m_objects) {
+		if (remaining() < sizeof(u32)) return false;
+		u32 length = in.read<u32>();
+		if (length < SNAPSHOT_OBJECT_SIZE || length > remaining()) return false;
+
+		if (in.read<u32>() != obj->m_id) return false;
+		in.skip(SNAPSHOT_OBJECT_SIZE - sizeof(u32) - sizeof(bool));
+		bool hasBody = in.read<bool>();
+		if (hasBody && length < SNAPSHOT_OBJECT_SIZE + SNAPSHOT_BODY_SIZE) return false;
+		in.skip(length - SNAPSHOT_OBJECT_SIZE);
+	}
+
+	if (remaining() < sizeof(u32)) return false;
+	u64 contactCount = in.read<u32>();
+	return remaining() == contactCount * sizeof(ContactState);
 }
 
 void Scene::initPhysics() {
-	m_physicsWorld = UPtr<b2World>(new b2World(b2Vec2(0.0f, 0.0f)));
+	m_random.seed(m_seed);
+
+	m_physicsWorld = UPtr<b2World>(new b2World(b2Vec2(0.0f, 0.0f), m_physicsAllocator));
 	m_physicsWorld->SetAllowSleeping(true);
 	m_physicsWorld->SetContinuousPhysics(true);
 	m_physicsWorld->SetContactListener(this);
@@ -100,6 +407,9 @@ SceneManager::SceneManager() {
 	m_currentScene = "";
 	m_nextScene = "";
 	m_changingScenes = false;
+	m_renderScene = nullptr;
+	m_tick = 0;
+	m_renderedTick = 0;
 }
 
 void SceneManager::registerScene(const String& name, Scene *scene) {
@@ -118,6 +428,16 @@ void SceneManager::setScene(const String& name) {
 
 void SceneManager::update(float dt) {
 	if (m_scenes.empty()) return;
+
+	u64 tick = m_tick.load(std::memory_order_relaxed) + 1;
+	m_tick.store(tick, std::memory_order_release);
+
+	u64 renderedTick = m_renderedTick.load(std::memory_order_acquire);
+	for (auto&& kv : m_scenes) {
+		kv.second->m_tick = tick;
+		kv.second->collectGarbage(renderedTick);
+	}
+
 	if (m_changingScenes) {
 		if (!m_currentScene.empty()) {
 			current()->destroy();
@@ -126,7 +446,9 @@ void SceneManager::update(float dt) {
 		if (!m_currentScene.empty()) {
 			current()->initPhysics();
 			current()->create();
+			current()->m_staticGeometry.bake();
 		}
+		m_renderScene.store(current(), std::memory_order_release);
 		m_changingScenes = false;
 	} else {
 		if (!m_currentScene.empty())
@@ -135,8 +457,11 @@ void SceneManager::update(float dt) {
 }
 
 void SceneManager::render(RenderContext* context) {
-	if (m_scenes.empty() || m_currentScene.empty()) return;
-	if (!m_changingScenes) {
-		m_scenes[m_currentScene]->render(context);
+	// Everything removed before this tick is out of every snapshot this frame can see
+	m_renderedTick.store(m_tick.load(std::memory_order_acquire), std::memory_order_release);
+
+	Scene *scene = m_renderScene.load(std::memory_order_acquire);
+	if (scene != nullptr) {
+		scene->render(context);
 	}
-}
\ No newline at end of file
+}
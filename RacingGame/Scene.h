@@ -3,6 +3,18 @@
 
 #include "DebugDraw.h"
 #include "GameObject.h"
+#include "StaticGeometry.h"
+#include "TripleBuffer.h"
+
+#include <atomic>
+
+#define MAX_CONTACT_EVENTS 1024
+
+// Everything the renderer reads from a scene for one tick
+struct RenderSnapshot {
+	u64 tick{ 0 };
+	Vec<ObjectRenderState> objects;
+};
 
 class Scene : public b2ContactListener {
 	friend class GameObject;
@@ -16,21 +28,92 @@ public:
 	void render(RenderContext *context);
 	void destroy();
 
+	// Tick of the snapshot the last render() drew
+	u64 renderedTick() const { return m_renderedTick; }
+
 	void add(GameObject *obj);
 
+	// Level geometry registered in create(), baked once it returns and drawn
+	// every frame without going through the objects
+	StaticGeometry& staticGeometry() { return m_staticGeometry; }
+
 	b2World* physicsWorld() { return m_physicsWorld.get(); }
 
+	// Pool sizes for the physics world. Set them before the scene starts;
+	// the pool counters are logged when the scene is destroyed.
+	void physicsAllocator(const b2WorldAllocatorDef& def) { m_physicsAllocator = def; }
+	const b2WorldAllocatorDef& physicsAllocator() const { return m_physicsAllocator; }
+
+	// Seed used to reset random() when the scene is (re)created.
+	// Set it before the scene starts to get a reproducible simulation.
+	void seed(u64 s) { m_seed = s; }
+	u64 seed() const { return m_seed; }
+
+	// Use this instead of Utils::random() for anything that affects the simulation
+	Random& random() { return m_random; }
+
+	// Hash of every body transform and velocity, for comparing runs tick by tick
+	u64 stateHash() const;
+
+	// Simulation level of detail: AI cars farther than lodDistance from the
+	// focus object leave the physics world and follow their track spline.
+	void lodFocus(GameObject *obj) { m_lodFocus = obj; }
+	GameObject* lodFocus() { return m_lodFocus; }
+
+	void lodDistance(float d) { m_lodDistance = d; }
+	float lodDistance() const { return m_lodDistance; }
+
+	// Snapshot of the simulation: object transforms, body velocities and pending
+	// forces, contact manifolds (for warm starting), behavior state and the RNG.
+	// Call between ticks.
+	// Restoring expects the same set of objects that was saved; a record that does
+	// not match or is truncated is rejected before anything is changed.
+	void saveState(BinWriter& out);
+	bool restoreState(u8* data, size_t size);
+
 	// Box2D
 	virtual void BeginContact(b2Contact* contact);
 	virtual void EndContact(b2Contact* contact) { }
 
 private:
 	Vec<UPtr<GameObject>> m_objects, m_addList;
+	u32 m_nextId{ 0 };
+
+	u64 m_seed;
+	Random m_random;
+
+	GameObject *m_lodFocus{ nullptr };
+	float m_lodDistance{ 20.0f };
+
+	struct ContactState {
+		u32 objectA, objectB;
+		i32 fixtureA, fixtureB, childA, childB;
+		b2Manifold manifold;
+	};
+	Vec<ContactState> m_restoredContacts;
+	bool validateState(u8* data, size_t size);
+
+	// Contacts are recorded while the world is locked and dispatched after Step
+	Array<Collision, MAX_CONTACT_EVENTS> m_contacts;
+	u32 m_contactCount{ 0 }, m_droppedContacts{ 0 };
+	void dispatchContacts();
 
 	UPtr<PhysicsDebugDraw> m_debugDraw;
 
+	StaticGeometry m_staticGeometry;
+
+	// Rendering only sees the published snapshots. Removed objects are kept
+	// until the render thread has moved past the tick that removed them.
+	TripleBuffer<RenderSnapshot> m_snapshots;
+	Vec<std::pair<u64, UPtr<GameObject>>> m_graveyard;
+	u64 m_tick{ 0 }, m_renderedTick{ 0 };
+	Vec<GameObject*> m_parallelRender; // render thread only
+	void publishSnapshot();
+	void collectGarbage(u64 renderedTick);
+
 	// Physics
 	UPtr<b2World> m_physicsWorld;
+	b2WorldAllocatorDef m_physicsAllocator;
 	void initPhysics();
 };
 
@@ -42,15 +125,25 @@ public:
 	void registerScene(const String& name, Scene* scene);
 	void setScene(const String& name);
 
+	// Destroys and recreates the current scene on the next update, with the same seed
+	void restart() { setScene(m_currentScene); }
+
 	void update(float dt);
 	void render(RenderContext *context);
 
 	Scene* current() { return !m_scenes.empty() ? m_scenes[m_currentScene].get() : nullptr; }
 
+	// Simulation ticks run so far
+	u64 tick() const { return m_tick.load(std::memory_order_acquire); }
+
 private:
 	UMap<String, UPtr<Scene>> m_scenes;
 	String m_nextScene, m_currentScene;
 	bool m_changingScenes;
+
+	// update() and render() may run on different threads, these are the only shared state
+	std::atomic<Scene*> m_renderScene;
+	std::atomic<u64> m_tick, m_renderedTick;
 };
 
 #endif // SCENE_H
\ No newline at end of file
@@ -2,11 +2,55 @@
 
 #include "Utils.h"
 #include "Logger.h"
+#include "BinIO.h"
 #include <numeric>
+#include <fstream>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+// ARB_get_program_binary (core in 4.1) is not in the generated 3.3 loader
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC_)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC_)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC_)(GLuint program, GLenum pname, GLint value);
+
+static PFNGLGETPROGRAMBINARYPROC_ glGetProgramBinary_ = nullptr;
+static PFNGLPROGRAMBINARYPROC_ glProgramBinary_ = nullptr;
+static PFNGLPROGRAMPARAMETERIPROC_ glProgramParameteri_ = nullptr;
+
+#define PROGRAM_CACHE_MAGIC 0x4E494250 // PBIN
+
+static bool programBinarySupported() {
+	static bool supported = [] {
+#ifdef _WIN32
+		glGetProgramBinary_ = (PFNGLGETPROGRAMBINARYPROC_) wglGetProcAddress("glGetProgramBinary");
+		glProgramBinary_ = (PFNGLPROGRAMBINARYPROC_) wglGetProcAddress("glProgramBinary");
+		glProgramParameteri_ = (PFNGLPROGRAMPARAMETERIPROC_) wglGetProcAddress("glProgramParameteri");
+#endif
+		if (!glGetProgramBinary_ || !glProgramBinary_ || !glProgramParameteri_) return false;
+
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		return formats > 0;
+	}();
+	return supported;
+}
 
 Vec<ShaderProgram> Factory<ShaderProgram>::s_shaderPrograms;
+String ShaderProgram::s_cacheDirectory = "shadercache";
+ShaderStats ShaderProgram::s_stats = { 0, 0, 0.0 };
 
 ShaderProgram& ShaderProgram::addSource(ShaderType type, const String& src) {
+	m_sources.push_back({ type, src });
+	return *this;
+}
+
+bool ShaderProgram::compile(ShaderType type, const String& src) {
 	const char* csrc = src.c_str();
 	
 	GLuint shader = glCreateShader(type);
@@ -39,26 +83,163 @@ ShaderProgram& ShaderProgram::addSource(ShaderType type, const String& src) {
 	}
 	glDeleteShader(shader);
 
-	return *this;
+	return status != GL_FALSE;
 }
 
 ShaderProgram& ShaderProgram::link() {
+	double start = Utils::currentTime();
+	s_stats.linked++;
+
+	String cacheFile;
+	if (!s_cacheDirectory.empty() && programBinarySupported()) {
+		// Binaries are only valid for the driver that made them
+		u64 key = Utils::hash("", 0);
+		for (auto&& src : m_sources) {
+			key = Utils::hash(&src.first, sizeof(src.first), key);
+			key = Utils::hash(src.second.data(), src.second.size(), key);
+		}
+		for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+			const char* str = reinterpret_cast<const char*>(glGetString(name));
+			if (str) key = Utils::hash(str, std::strlen(str), key);
+		}
+
+		char hex[17];
+		auto res = std::to_chars(hex, hex + 16, key, 16);
+		*res.ptr = '\0';
+		cacheFile = s_cacheDirectory + "/" + hex + ".bin";
+
+		if (loadBinary(cacheFile)) {
+			s_stats.cached++;
+			s_stats.seconds += Utils::currentTime() - start;
+			m_sources.clear();
+			return *this;
+		}
+		glProgramParameteri_(m_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
+	for (auto&& src : m_sources) {
+		compile(src.first, src.second);
+	}
+	m_sources.clear();
 	glLinkProgram(m_program);
+
+	GLint status = 0;
+	glGetProgramiv(m_program, GL_LINK_STATUS, &status);
+	if (status == GL_FALSE) {
+		char log[2048];
+		glGetProgramInfoLog(m_program, 2048, nullptr, log);
+		LogError("Link failed:\n", log);
+	} else if (!cacheFile.empty()) {
+		saveBinary(cacheFile);
+	}
+
+	s_stats.seconds += Utils::currentTime() - start;
 	return *this;
 }
 
+bool ShaderProgram::loadBinary(const String& fileName) {
+	std::ifstream in(fileName, std::ios::binary);
+	if (!in) return false;
+
+	Vec<u8> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	if (data.size() < sizeof(u32) * 3) return false;
+
+	BinReader reader(data.data());
+	u32 magic = reader.read<u32>();
+	GLenum format = reader.read<u32>();
+	u32 length = reader.read<u32>();
+	if (magic != PROGRAM_CACHE_MAGIC || length != data.size() - sizeof(u32) * 3) return false;
+
+	glProgramBinary_(m_program, format, reader.position(), GLsizei(length));
+
+	// Drivers reject binaries after updates, then we just compile again
+	GLint status = 0;
+	glGetProgramiv(m_program, GL_LINK_STATUS, &status);
+	return status != GL_FALSE;
+}
+
+void ShaderProgram::saveBinary(const String& fileName) {
+	GLint length = 0;
+	glGetProgramiv(m_program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) return;
+
+	Vec<u8> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary_(m_program, length, nullptr, &format, binary.data());
+
+	BinWriter writer;
+	writer.writeAll(u32(PROGRAM_CACHE_MAGIC), u32(format), u32(length));
+
+	std::error_code err;
+	std::filesystem::create_directories(s_cacheDirectory, err);
+
+	std::ofstream out(fileName, std::ios::binary);
+	if (!out) {
+		LogWarning("Could not write shader cache: \"", fileName, "\"");
+		return;
+	}
+	out.write(reinterpret_cast<const char*>(writer.data()), writer.dataSize());
+	out.write(reinterpret_cast<const char*>(binary.data()), binary.size());
+}
+
 void ShaderProgram::use() {
 	glUseProgram(m_program);
 }
 
 u32 ShaderProgram::getUniformLocation(const String& name) {
-	if (m_uniforms.find(name) == m_uniforms.end()) {
-		int loc = glGetUniformLocation(m_program, name.c_str());
-		if (loc != -1) {
-			m_uniforms.insert({ name, u32(loc) });
-		} else {
-			LogWarning("Invalid uniform name: \"", name, "\"");
+	auto it = m_uniforms.find(name);
+	if (it != m_uniforms.end()) {
+		return it->second;
+	}
+
+	// Unknown names are cached as -1 too (setting it is a no-op), so they only warn once
+	int loc = glGetUniformLocation(m_program, name.c_str());
+	if (loc == -1) {
+		LogWarning("Invalid uniform name: \"", name, "\"");
+	}
+	m_uniforms.insert({ name, u32(loc) });
+	return u32(loc);
+}
+
+String ShaderProgram::specialize(const String& src, const Vec<String>& defines) {
+	if (defines.empty()) return src;
+
+	String header;
+	for (auto&& def : defines) {
+		header += "#define " + def + "\n";
+	}
+
+	size_t version = src.find("#version");
+	size_t pos = version == String::npos ? 0 : src.find('\n', version);
+	if (pos == String::npos) return src + "\n" + header;
+	if (version != String::npos) pos++;
+
+	String out = src;
+	out.insert(pos, header);
+	return out;
+}
+
+ShaderProgram& ShaderPermutations::get(u32 key) {
+	auto it = m_programs.find(key);
+	if (it != m_programs.end()) {
+		return it->second;
+	}
+
+	Vec<String> defines;
+	for (u32 i = 0; i < m_defines.size(); i++) {
+		if (key & (1u << i)) {
+			defines.push_back(m_defines[i]);
 		}
 	}
-	return m_uniforms[name];
+
+	ShaderProgram prog = ShaderFactory::create()
+		.addSource(ShaderProgram::VertexShader, ShaderProgram::specialize(m_vs, defines))
+		.addSource(ShaderProgram::FragmentShader, ShaderProgram::specialize(m_fs, defines))
+		.link();
+
+	const ShaderStats& stats = ShaderProgram::stats();
+	LogInfo("Shader permutation ", key, " ready (", stats.linked, " linked, ",
+		stats.cached, " from cache, ", stats.seconds * 1000.0, " ms total)");
+
+	return m_programs.insert({ key, prog }).first->second;
 }
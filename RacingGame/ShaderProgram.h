@@ -29,6 +29,11 @@ private:
 	Uniform(u32 loc) : loc(loc) {}
 };
 
+struct ShaderStats {
+	u32 linked, cached;
+	double seconds;
+};
+
 class ShaderProgram {
 	friend class Factory<ShaderProgram>;
 public:
@@ -40,6 +45,7 @@ public:
 	ShaderProgram() = default;
 	~ShaderProgram() = default;
 
+	// Sources are compiled by link(), unless a cached binary for them is found
 	ShaderProgram& addSource(ShaderType type, const String& src);
 	ShaderProgram& link();
 
@@ -49,9 +55,30 @@ public:
 
 	u32 getUniformLocation(const String& name);
 
+	GLuint id() const { return m_program; }
+
+	// Inserts a #define for each name right after the #version line
+	static String specialize(const String& src, const Vec<String>& defines);
+
+	// Linked programs are saved here (keyed by source and driver) and loaded
+	// on later runs instead of compiling. Empty disables the cache.
+	static void cacheDirectory(const String& dir) { s_cacheDirectory = dir; }
+	static String cacheDirectory() { return s_cacheDirectory; }
+
+	// Totals for every link() so far
+	static const ShaderStats& stats() { return s_stats; }
+
 protected:
 	GLuint m_program;
 	UMap<String, u32> m_uniforms;
+	Vec<std::pair<ShaderType, String>> m_sources;
+
+	bool compile(ShaderType type, const String& src);
+	bool loadBinary(const String& fileName);
+	void saveBinary(const String& fileName);
+
+	static String s_cacheDirectory;
+	static ShaderStats s_stats;
 };
 
 template <>
@@ -77,4 +104,23 @@ private:
 
 using ShaderFactory = Factory<ShaderProgram>;
 
+// Variants of one shader specialized at compile time with #defines,
+// compiled on first use. Bit i of a key enables defines[i].
+class ShaderPermutations {
+public:
+	ShaderPermutations() = default;
+	ShaderPermutations(const String& vs, const String& fs, const Vec<String>& defines)
+		: m_vs(vs), m_fs(fs), m_defines(defines)
+	{}
+
+	ShaderProgram& get(u32 key);
+
+	u32 compiled() const { return u32(m_programs.size()); }
+
+private:
+	String m_vs, m_fs;
+	Vec<String> m_defines;
+	UMap<u32, ShaderProgram> m_programs;
+};
+
 #endif // SHADER_PROGRAM_H
\ No newline at end of file
@@ -0,0 +1,179 @@
+#include "StaticGeometry.h"
+
+#include "Logger.h"
+#include "Profiler.h"
+
+StaticGeometry::~StaticGeometry() {
+	if (m_vao == 0) return;
+	glDeleteBuffers(1, &m_vbo);
+	glDeleteBuffers(1, &m_ebo);
+	glDeleteVertexArrays(1, &m_vao);
+}
+
+void StaticGeometry::add(const Mesh& mesh, const glm::mat4& modelMatrix, Texture2D color, Texture2D normal, Texture2D specular) {
+	Drawable d{};
+	d.color = color.id();
+	d.normal = normal.id();
+	d.specular = specular.id();
+	d.features = RenderContext::textureFeatures(normal, specular);
+	addMesh(mesh, modelMatrix, d, 0.0f);
+}
+
+void StaticGeometry::add(const Mesh& mesh, const glm::mat4& modelMatrix, const Material& material) {
+	Drawable d{};
+	d.color = material.color;
+	d.normal = material.normal;
+	d.specular = material.specular;
+	d.features = RenderContext::FeatureTextureArray | RenderContext::FeatureNormalMap | RenderContext::FeatureSpecularMap;
+	addMesh(mesh, modelMatrix, d, float(material.layer));
+}
+
+void StaticGeometry::addSprite(Texture2D color, Texture2D normal, Texture2D specular, glm::vec4 vcolor) {
+	Drawable d{};
+	d.color = color.id();
+	d.normal = normal.id();
+	d.specular = specular.id();
+	d.features = RenderContext::textureFeatures(normal, specular);
+	d.origin = m_cursor.m_position;
+	addPiece(m_cursor.quad(color.width(), color.height(), color.region(), 0.0f, vcolor), d, 0.0f);
+}
+
+void StaticGeometry::addSprite(const Material& material, glm::vec4 vcolor) {
+	Drawable d{};
+	d.color = material.color;
+	d.normal = material.normal;
+	d.specular = material.specular;
+	d.features = RenderContext::FeatureTextureArray | RenderContext::FeatureNormalMap | RenderContext::FeatureSpecularMap;
+	d.origin = m_cursor.m_position;
+	const float layer = float(material.layer);
+	addPiece(m_cursor.quad(material.width, material.height, glm::vec4(0, 0, 1, 1), layer, vcolor), d, layer);
+}
+
+void StaticGeometry::addMesh(const Mesh& mesh, const glm::mat4& modelMatrix, Drawable d, float layer) {
+	Mesh world = mesh;
+	world.transform(modelMatrix);
+
+	// transform() only moves positions, there is no model matrix left to turn the rest
+	const glm::mat3 basis(modelMatrix);
+	Vec<Vertex> verts = world.vertices();
+	for (Vertex& v : verts) {
+		v.normal = basis * v.normal;
+		v.tangent = basis * v.tangent;
+	}
+	world.vertices(verts);
+
+	d.origin = glm::vec3(modelMatrix[3]);
+	addPiece(world, d, layer);
+}
+
+void StaticGeometry::addPiece(const Mesh& mesh, Drawable d, float layer) {
+	// Batches are drawn before the sorted ones, blending would depend on what is behind
+	for (const Vertex& v : mesh.vertices()) {
+		if (v.color.a < 1.0f) {
+			LogWarning("Static geometry is drawn opaque, translucent vertex colors are ignored.");
+			break;
+		}
+	}
+
+	d.vertexOffset = u32(m_vertices.size());
+	d.indexOffset = u32(m_indices.size());
+	d.indexCount = u32(mesh.indices().size());
+	d.matrix = NO_TRANSFORM;
+	d.translucent = false;
+
+	m_vertices.insert(m_vertices.end(), mesh.vertices().begin(), mesh.vertices().end());
+	for (u32 i = d.vertexOffset; i < m_vertices.size(); i++) {
+		m_vertices[i].layer = layer;
+	}
+	m_indices.insert(m_indices.end(), mesh.indices().begin(), mesh.indices().end());
+	m_pieces.push_back(d);
+}
+
+void StaticGeometry::bake() {
+	ProfileZone("StaticGeometry::bake");
+
+	// Group by material, pieces of one material keep the order they were added in
+	Vec<u32> order(m_pieces.size());
+	for (u32 i = 0; i < order.size(); i++) order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](u32 a, u32 b) -> bool {
+		const Drawable& da = m_pieces[a];
+		const Drawable& db = m_pieces[b];
+		return std::tie(da.features, da.color, da.normal, da.specular) <
+			std::tie(db.features, db.color, db.normal, db.specular);
+	});
+
+	Baked baked;
+	baked.vertices = m_vertices;
+	baked.indices.reserve(m_indices.size());
+	for (u32 i : order) {
+		const Drawable& d = m_pieces[i];
+		Batch* last = baked.batches.empty() ? nullptr : &baked.batches.back();
+		if (last &&
+			last->color == d.color &&
+			last->normal == d.normal &&
+			last->specular == d.specular &&
+			last->features == d.features)
+		{
+			last->length += d.indexCount;
+		} else {
+			baked.batches.push_back({
+				u32(baked.indices.size()), d.indexCount, NO_TRANSFORM,
+				d.color, d.normal, d.specular,
+				d.features
+			});
+		}
+
+		const u32* src = m_indices.data() + d.indexOffset;
+		for (u32 j = 0; j < d.indexCount; j++) {
+			baked.indices.push_back(src[j] + d.vertexOffset);
+		}
+	}
+
+	LogInfo("Baked ", m_pieces.size(), " static pieces into ", baked.batches.size(), " draw calls.");
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_pending = std::move(baked);
+	m_dirty = true;
+}
+
+void StaticGeometry::clear() {
+	m_pieces.clear();
+	m_vertices.clear();
+	m_indices.clear();
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_pending = Baked();
+	m_dirty = true;
+}
+
+bool StaticGeometry::upload() {
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (m_dirty) {
+			if (m_vao == 0) {
+				glGenBuffers(1, &m_vbo);
+				glGenBuffers(1, &m_ebo);
+				glGenVertexArrays(1, &m_vao);
+
+				glBindVertexArray(m_vao);
+				glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+				Vertex::setupAttributes();
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo);
+				glBindVertexArray(0);
+			}
+
+			glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+			glBufferData(GL_ARRAY_BUFFER, m_pending.vertices.size() * sizeof(Vertex), m_pending.vertices.data(), GL_STATIC_DRAW);
+
+			// The element buffer binding is VAO state
+			glBindVertexArray(m_vao);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_pending.indices.size() * sizeof(u32), m_pending.indices.data(), GL_STATIC_DRAW);
+			glBindVertexArray(0);
+
+			m_batches = std::move(m_pending.batches);
+			m_pending = Baked();
+			m_dirty = false;
+		}
+	}
+	return !m_batches.empty();
+}
@@ -0,0 +1,64 @@
+#ifndef STATIC_GEOMETRY_H
+#define STATIC_GEOMETRY_H
+
+#include "RenderContext.h"
+
+#include <mutex>
+
+// Level geometry that never moves. Meshes and sprites are registered once,
+// bake() merges them into one vertex and index buffer with a range per
+// material, and the renderer draws each range with a single call.
+// Registering and baking may happen on the simulation thread, the GL buffers
+// are filled by the render thread the next time it draws.
+class StaticGeometry {
+	friend class RenderContext;
+public:
+	StaticGeometry() = default;
+	~StaticGeometry();
+
+	void add(const Mesh& mesh, const glm::mat4& modelMatrix, Texture2D color, Texture2D normal, Texture2D specular);
+	void add(const Mesh& mesh, const glm::mat4& modelMatrix, const Material& material);
+
+	// Placed by cursor(), like RenderContext::submitSprite
+	void addSprite(Texture2D color, Texture2D normal, Texture2D specular, glm::vec4 vcolor = glm::vec4(1));
+	void addSprite(const Material& material, glm::vec4 vcolor = glm::vec4(1));
+
+	// Hands everything added so far to the renderer, replacing the previous bake
+	void bake();
+	// Removes all geometry, baked or not
+	void clear();
+
+	Cursor& cursor() { return m_cursor; }
+
+	u32 vertexCount() const { return u32(m_vertices.size()); }
+
+private:
+	// Registered pieces, transformed to world space
+	Vec<Drawable> m_pieces;
+	Vec<Vertex> m_vertices;
+	Vec<u32> m_indices;
+	Cursor m_cursor;
+
+	struct Baked {
+		Vec<Vertex> vertices;
+		Vec<u32> indices;
+		Vec<Batch> batches;
+	};
+
+	// Written by bake(), taken by upload()
+	std::mutex m_lock;
+	Baked m_pending;
+	bool m_dirty{ false };
+
+	// Render thread only
+	GLuint m_vbo{ 0 }, m_ebo{ 0 }, m_vao{ 0 };
+	Vec<Batch> m_batches;
+
+	void addMesh(const Mesh& mesh, const glm::mat4& modelMatrix, Drawable d, float layer);
+	void addPiece(const Mesh& mesh, Drawable d, float layer);
+
+	// Takes a pending bake, false when there is nothing to draw
+	bool upload();
+};
+
+#endif // STATIC_GEOMETRY_H
\ No newline at end of file
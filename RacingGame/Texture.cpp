@@ -1,6 +1,9 @@
 #include "Texture.h"
 
+#include <algorithm>
+
 Vec<Texture2D> Factory<Texture2D>::s_textures;
+Vec<TextureArray> Factory<TextureArray>::s_textures;
 
 Texture2D& Texture2D::setData(ImageData& data) {
 	glTexImage2D(
@@ -14,6 +17,31 @@ Texture2D& Texture2D::setData(ImageData& data) {
 	return *this;
 }
 
+Texture2D& Texture2D::setData(const CompressedImage& data) {
+	for (u32 level = 0; level < data.levels.size(); level++) {
+		const u32 w = data.levelWidth(level), h = data.levelHeight(level);
+		if (data.format == FormatRGBA8) {
+			glTexImage2D(
+				GL_TEXTURE_2D, level, GL_RGBA8,
+				w, h,
+				0, GL_RGBA, GL_UNSIGNED_BYTE,
+				data.levels[level].data()
+			);
+		} else {
+			glCompressedTexImage2D(
+				GL_TEXTURE_2D, level, TextureCompressor::glFormat(data.format),
+				w, h, 0,
+				GLsizei(data.levels[level].size()),
+				data.levels[level].data()
+			);
+		}
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(data.levels.size()) - 1);
+	m_width = data.width;
+	m_height = data.height;
+	return *this;
+}
+
 Texture2D& Texture2D::setFilter(GLenum min, GLenum mag) {
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mag);
@@ -31,6 +59,19 @@ Texture2D& Texture2D::generateMipmaps() {
 	return *this;
 }
 
+Texture2D Texture2D::subTexture(u32 x, u32 y, u32 width, u32 height) const {
+	Texture2D sub = *this;
+	sub.m_width = width;
+	sub.m_height = height;
+	sub.m_region = glm::vec4(
+		m_region.x + m_region.z * float(x) / float(m_width),
+		m_region.y + m_region.w * float(y) / float(m_height),
+		m_region.z * float(width) / float(m_width),
+		m_region.w * float(height) / float(m_height)
+	);
+	return sub;
+}
+
 void Texture2D::bind(u32 slot) {
 	glActiveTexture(GL_TEXTURE0 + slot);
 	glBindTexture(GL_TEXTURE_2D, m_id);
@@ -39,3 +80,92 @@ void Texture2D::bind(u32 slot) {
 void Texture2D::unbind() {
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
+
+TextureArray& TextureArray::allocate(u32 width, u32 height, u32 layers, TextureFormat format) {
+	m_width = width;
+	m_height = height;
+	m_layers = layers;
+	m_format = format;
+
+	u32 levels = 1;
+	while ((std::max(width, height) >> levels) > 0) levels++;
+
+	for (u32 level = 0; level < levels; level++) {
+		const u32 w = std::max(width >> level, 1u), h = std::max(height >> level, 1u);
+		if (format == FormatRGBA8) {
+			glTexImage3D(
+				GL_TEXTURE_2D_ARRAY, level, GL_RGBA8,
+				w, h, layers,
+				0, GL_RGBA, GL_UNSIGNED_BYTE,
+				nullptr
+			);
+		} else {
+			glCompressedTexImage3D(
+				GL_TEXTURE_2D_ARRAY, level, TextureCompressor::glFormat(format),
+				w, h, layers, 0,
+				GLsizei(TextureCompressor::levelSize(format, w, h) * layers),
+				nullptr
+			);
+		}
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	return *this;
+}
+
+TextureArray& TextureArray::setLayer(u32 layer, ImageData& data) {
+	glTexSubImage3D(
+		GL_TEXTURE_2D_ARRAY, 0,
+		0, 0, layer,
+		m_width, m_height, 1,
+		GL_RGBA, GL_UNSIGNED_BYTE,
+		data.pixels()
+	);
+	return *this;
+}
+
+TextureArray& TextureArray::setLayer(u32 layer, const CompressedImage& data) {
+	for (u32 level = 0; level < data.levels.size(); level++) {
+		const u32 w = data.levelWidth(level), h = data.levelHeight(level);
+		if (data.format == FormatRGBA8) {
+			glTexSubImage3D(
+				GL_TEXTURE_2D_ARRAY, level,
+				0, 0, layer,
+				w, h, 1,
+				GL_RGBA, GL_UNSIGNED_BYTE,
+				data.levels[level].data()
+			);
+		} else {
+			glCompressedTexSubImage3D(
+				GL_TEXTURE_2D_ARRAY, level,
+				0, 0, layer,
+				w, h, 1,
+				TextureCompressor::glFormat(data.format),
+				GLsizei(data.levels[level].size()),
+				data.levels[level].data()
+			);
+		}
+	}
+	return *this;
+}
+
+TextureArray& TextureArray::setFilter(GLenum min, GLenum mag) {
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, min);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, mag);
+	return *this;
+}
+
+TextureArray& TextureArray::setWrap(GLenum s, GLenum t) {
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, s);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, t);
+	return *this;
+}
+
+TextureArray& TextureArray::generateMipmaps() {
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	return *this;
+}
+
+void TextureArray::bind(u32 slot) {
+	glActiveTexture(GL_TEXTURE0 + slot);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_id);
+}
@@ -3,14 +3,19 @@
 
 #include "glad.h"
 #include "ImageData.h"
+#include "TextureCompression.h"
 #include "Factory.h"
 
+#include "glm/vec4.hpp"
+
 class Texture2D {
 	friend class Factory<Texture2D>;
 public:
-	Texture2D() : m_id(0), m_width(0), m_height(0) {}
+	Texture2D() : m_id(0), m_width(0), m_height(0), m_region(0, 0, 1, 1) {}
 
 	Texture2D& setData(ImageData& data);
+	// Uploads every level as is, no generateMipmaps needed (or possible for BCn)
+	Texture2D& setData(const CompressedImage& data);
 	Texture2D& setFilter(GLenum min, GLenum mag);
 	Texture2D& setWrap(GLenum s, GLenum t);
 	Texture2D& generateMipmaps();
@@ -18,13 +23,20 @@ public:
 	void bind(u32 slot = 0);
 	void unbind();
 
+	// Same GL texture, limited to a pixel rectangle (e.g. an image in an atlas page)
+	Texture2D subTexture(u32 x, u32 y, u32 width, u32 height) const;
+
 	u32 width() const { return m_width; }
 	u32 height() const { return m_height; }
 	GLuint id() const { return m_id; }
 
+	// Part of the GL texture this one covers, UV offset (xy) and size (zw)
+	const glm::vec4& region() const { return m_region; }
+
 private:
 	u32 m_width, m_height;
 	GLuint m_id;
+	glm::vec4 m_region;
 };
 
 template<>
@@ -50,4 +62,56 @@ private:
 
 using Texture2DFactory = Factory<Texture2D>;
 
+// Same sized layers behind one binding, the shader picks the layer
+class TextureArray {
+	friend class Factory<TextureArray>;
+public:
+	TextureArray() : m_width(0), m_height(0), m_layers(0), m_format(FormatRGBA8), m_id(0) {}
+
+	// Storage for the full mip chain of every layer
+	TextureArray& allocate(u32 width, u32 height, u32 layers, TextureFormat format = FormatRGBA8);
+	TextureArray& setLayer(u32 layer, ImageData& data);
+	// All levels, the format must match the one allocated
+	TextureArray& setLayer(u32 layer, const CompressedImage& data);
+	TextureArray& setFilter(GLenum min, GLenum mag);
+	TextureArray& setWrap(GLenum s, GLenum t);
+	TextureArray& generateMipmaps();
+
+	void bind(u32 slot = 0);
+
+	u32 width() const { return m_width; }
+	u32 height() const { return m_height; }
+	u32 layers() const { return m_layers; }
+	TextureFormat format() const { return m_format; }
+	GLuint id() const { return m_id; }
+
+private:
+	u32 m_width, m_height, m_layers;
+	TextureFormat m_format;
+	GLuint m_id;
+};
+
+template<>
+class Factory<TextureArray> {
+public:
+	static TextureArray& create() {
+		TextureArray tex{};
+		glGenTextures(1, &tex.m_id);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, tex.m_id);
+		s_textures.push_back(tex);
+		return s_textures.back();
+	}
+
+	static void release() {
+		for (auto&& tex : s_textures) {
+			glDeleteTextures(1, &tex.m_id);
+		}
+		s_textures.clear();
+	}
+private:
+	static Vec<TextureArray> s_textures;
+};
+
+using TextureArrayFactory = Factory<TextureArray>;
+
 #endif // TEXTURE_H
\ No newline at end of file
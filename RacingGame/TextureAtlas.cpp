@@ -0,0 +1,117 @@
+#include "TextureAtlas.h"
+
+#include "Logger.h"
+#include <algorithm>
+#include <numeric>
+
+SkylinePacker::SkylinePacker(u32 width, u32 height)
+	: m_width(width), m_height(height), m_used(0)
+{
+	m_skyline.push_back({ 0, 0, width });
+}
+
+bool SkylinePacker::fits(u32 index, u32 width, u32 height, u32& y) const {
+	const u32 x = m_skyline[index].x;
+	if (x + width > m_width) return false;
+
+	// Rests on the highest segment under it
+	y = 0;
+	u32 remaining = width;
+	for (u32 i = index; remaining > 0; i++) {
+		y = std::max(y, m_skyline[i].y);
+		if (y + height > m_height) return false;
+		remaining -= std::min(remaining, m_skyline[i].width);
+	}
+	return true;
+}
+
+bool SkylinePacker::pack(u32 width, u32 height, u32& x, u32& y) {
+	u32 best = u32(-1), bestY = u32(-1), bestWidth = u32(-1);
+	for (u32 i = 0; i < m_skyline.size(); i++) {
+		u32 top;
+		if (!fits(i, width, height, top)) continue;
+		if (top + height < bestY || (top + height == bestY && m_skyline[i].width < bestWidth)) {
+			best = i;
+			bestY = top + height;
+			bestWidth = m_skyline[i].width;
+		}
+	}
+	if (best == u32(-1)) return false;
+
+	x = m_skyline[best].x;
+	y = bestY - height;
+
+	// The new segment covers what it rests on, shrink or drop those
+	m_skyline.insert(m_skyline.begin() + best, { x, bestY, width });
+	const u32 right = x + width;
+	for (u32 i = best + 1; i < m_skyline.size();) {
+		Segment& seg = m_skyline[i];
+		if (seg.x >= right) break;
+		const u32 segRight = seg.x + seg.width;
+		if (segRight <= right) {
+			m_skyline.erase(m_skyline.begin() + i);
+			continue;
+		}
+		seg.width = segRight - right;
+		seg.x = right;
+		break;
+	}
+
+	// Merge neighbours at the same height
+	for (u32 i = 0; i + 1 < m_skyline.size();) {
+		if (m_skyline[i].y == m_skyline[i + 1].y) {
+			m_skyline[i].width += m_skyline[i + 1].width;
+			m_skyline.erase(m_skyline.begin() + i + 1);
+		} else {
+			i++;
+		}
+	}
+
+	m_used += u64(width) * height;
+	return true;
+}
+
+void TextureAtlas::build(const Vec<std::pair<String, ImageData*>>& images) {
+	Vec<u32> order(images.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](u32 a, u32 b) {
+		const ImageData& ia = *images[a].second;
+		const ImageData& ib = *images[b].second;
+		if (ia.height() != ib.height()) return ia.height() > ib.height();
+		return ia.width() > ib.width();
+	});
+
+	Vec<SkylinePacker> packers;
+	for (u32 i : order) {
+		const String& name = images[i].first;
+		ImageData& img = *images[i].second;
+		const u32 w = img.width() + ATLAS_PADDING * 2;
+		const u32 h = img.height() + ATLAS_PADDING * 2;
+		if (w > ATLAS_PAGE_SIZE || h > ATLAS_PAGE_SIZE) {
+			LogWarning("Too large for the atlas: \"", name, "\"");
+			continue;
+		}
+
+		u32 page = 0, x = 0, y = 0;
+		for (; page < packers.size(); page++) {
+			if (packers[page].pack(w, h, x, y)) break;
+		}
+		if (page == packers.size()) {
+			packers.emplace_back(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+			m_pages.emplace_back(new ImageData(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE));
+			packers.back().pack(w, h, x, y);
+		}
+
+		m_pages[page]->blit(img, x + ATLAS_PADDING, y + ATLAS_PADDING, ATLAS_PADDING);
+		m_regions[name] = { page, x + ATLAS_PADDING, y + ATLAS_PADDING, img.width(), img.height() };
+	}
+
+	for (u32 i = 0; i < packers.size(); i++) {
+		LogInfo("Atlas page ", i, ": ", u32(packers[i].occupancy() * 100.0f), "% used");
+	}
+}
+
+const AtlasRegion* TextureAtlas::find(const String& name) const {
+	auto it = m_regions.find(name);
+	return it != m_regions.end() ? &it->second : nullptr;
+}
@@ -0,0 +1,57 @@
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+// Load-time sprite atlases
+// Images are packed with a skyline bottom-left packer into fixed size pages,
+// each one then needs a single texture instead of one per image.
+
+#include "ImageData.h"
+#include "Memory.h"
+
+#define ATLAS_PAGE_SIZE 2048
+#define ATLAS_PADDING 4 // edges are extruded into it, so filtering and the first mips don't bleed
+
+class SkylinePacker {
+public:
+	SkylinePacker(u32 width, u32 height);
+
+	// Finds the lowest spot (then the leftmost) for the rectangle, false if there is none
+	bool pack(u32 width, u32 height, u32& x, u32& y);
+
+	// Area packed so far over the page area
+	float occupancy() const { return float(double(m_used) / (double(m_width) * m_height)); }
+
+private:
+	// Top edge of the packed area, left to right, covering the whole width
+	struct Segment {
+		u32 x, y, width;
+	};
+
+	Vec<Segment> m_skyline;
+	u32 m_width, m_height;
+	u64 m_used;
+
+	bool fits(u32 index, u32 width, u32 height, u32& y) const;
+};
+
+struct AtlasRegion {
+	u32 page;
+	u32 x, y, width, height;
+};
+
+class TextureAtlas {
+public:
+	// Larger images first. Those that don't fit in a page are left out.
+	void build(const Vec<std::pair<String, ImageData*>>& images);
+
+	const AtlasRegion* find(const String& name) const;
+
+	u32 pageCount() const { return u32(m_pages.size()); }
+	ImageData& page(u32 index) { return *m_pages[index]; }
+
+private:
+	Vec<UPtr<ImageData>> m_pages;
+	UMap<String, AtlasRegion> m_regions;
+};
+
+#endif // TEXTURE_ATLAS_H
\ No newline at end of file
@@ -0,0 +1,328 @@
+#include "TextureCompression.h"
+
+#include "ThreadPool.h"
+#include "Utils.h"
+#include "Logger.h"
+
+#include <fstream>
+#include <filesystem>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define BC_SSE2 1
+#else
+#define BC_SSE2 0
+#endif
+
+#define BC_CACHE_MAGIC 0x58544342 // BCTX
+#define BC_ENCODER_VERSION 2 // bump when the encoder output changes
+
+String TextureCompressor::s_cacheDirectory = "texturecache";
+
+static u16 to565(const u8* c) {
+	return u16(((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | (c[2] >> 3));
+}
+
+static void from565(u16 v, u8* c) {
+	const u8 r = (v >> 11) & 0x1F, g = (v >> 5) & 0x3F, b = v & 0x1F;
+	c[0] = u8((r << 3) | (r >> 2));
+	c[1] = u8((g << 2) | (g >> 4));
+	c[2] = u8((b << 3) | (b >> 2));
+}
+
+static void blockBounds(const u8 block[64], u8 mn[4], u8 mx[4]) {
+#if BC_SSE2
+	const __m128i* rows = reinterpret_cast<const __m128i*>(block);
+	__m128i r0 = _mm_loadu_si128(rows + 0), r1 = _mm_loadu_si128(rows + 1);
+	__m128i r2 = _mm_loadu_si128(rows + 2), r3 = _mm_loadu_si128(rows + 3);
+
+	__m128i lo = _mm_min_epu8(_mm_min_epu8(r0, r1), _mm_min_epu8(r2, r3));
+	__m128i hi = _mm_max_epu8(_mm_max_epu8(r0, r1), _mm_max_epu8(r2, r3));
+
+	// Fold the 4 texels of each register into one
+	lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+	lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2)));
+	hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 3, 0, 1)));
+	hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 0, 3, 2)));
+
+	const u32 l = u32(_mm_cvtsi128_si32(lo)), h = u32(_mm_cvtsi128_si32(hi));
+	std::memcpy(mn, &l, 4);
+	std::memcpy(mx, &h, 4);
+#else
+	for (u32 c = 0; c < 4; c++) {
+		mn[c] = 255;
+		mx[c] = 0;
+	}
+	for (u32 i = 0; i < 16; i++) {
+		for (u32 c = 0; c < 4; c++) {
+			mn[c] = std::min(mn[c], block[i * 4 + c]);
+			mx[c] = std::max(mx[c], block[i * 4 + c]);
+		}
+	}
+#endif
+}
+
+// Always the 4 color mode, c0 > c1 (or all texels use c0)
+static void encodeColor(const u8 block[64], u8 out[8]) {
+	u8 mn[4], mx[4];
+	blockBounds(block, mn, mx);
+
+	// Pulling the ends in by 1/16 of the range lowers the average error
+	for (u32 c = 0; c < 3; c++) {
+		const u8 inset = u8((mx[c] - mn[c]) >> 4);
+		mn[c] += inset;
+		mx[c] -= inset;
+	}
+
+	const u16 c0 = to565(mx), c1 = to565(mn);
+	std::memcpy(out + 0, &c0, 2);
+	std::memcpy(out + 2, &c1, 2);
+
+	u32 indices = 0;
+	if (c0 > c1) {
+		u8 palette[4][3];
+		from565(c0, palette[0]);
+		from565(c1, palette[1]);
+		for (u32 c = 0; c < 3; c++) {
+			palette[2][c] = u8((2 * palette[0][c] + palette[1][c]) / 3);
+			palette[3][c] = u8((palette[0][c] + 2 * palette[1][c]) / 3);
+		}
+
+		for (u32 i = 0; i < 16; i++) {
+			const u8* px = block + i * 4;
+			u32 best = 0, bestDist = ~0u;
+			for (u32 p = 0; p < 4; p++) {
+				const int dr = px[0] - palette[p][0], dg = px[1] - palette[p][1], db = px[2] - palette[p][2];
+				const u32 dist = u32(dr * dr + dg * dg + db * db);
+				if (dist < bestDist) {
+					bestDist = dist;
+					best = p;
+				}
+			}
+			indices |= best << (i * 2);
+		}
+	}
+	std::memcpy(out + 4, &indices, 4);
+}
+
+// BC4 block for one channel, 8 value mode (a0 > a1)
+static void encodeChannel(const u8 block[64], u32 channel, u8 out[8]) {
+	u8 a0 = 0, a1 = 255;
+	for (u32 i = 0; i < 16; i++) {
+		a0 = std::max(a0, block[i * 4 + channel]);
+		a1 = std::min(a1, block[i * 4 + channel]);
+	}
+	out[0] = a0;
+	out[1] = a1;
+
+	u64 indices = 0;
+	if (a0 > a1) {
+		u8 palette[8] = { a0, a1 };
+		for (u32 k = 2; k < 8; k++) {
+			palette[k] = u8(((8 - k) * a0 + (k - 1) * a1 + 3) / 7);
+		}
+
+		for (u32 i = 0; i < 16; i++) {
+			const int v = block[i * 4 + channel];
+			u32 best = 0, bestDist = ~0u;
+			for (u32 p = 0; p < 8; p++) {
+				const u32 dist = u32(std::abs(v - palette[p]));
+				if (dist < bestDist) {
+					bestDist = dist;
+					best = p;
+				}
+			}
+			indices |= u64(best) << (i * 3);
+		}
+	}
+	for (u32 b = 0; b < 6; b++) {
+		out[2 + b] = u8(indices >> (b * 8));
+	}
+}
+
+void TextureCompressor::encodeBC1(const u8 block[64], u8 out[8]) {
+	encodeColor(block, out);
+}
+
+void TextureCompressor::encodeBC3(const u8 block[64], u8 out[16]) {
+	encodeChannel(block, 3, out);
+	encodeColor(block, out + 8);
+}
+
+void TextureCompressor::encodeBC5(const u8 block[64], u8 out[16]) {
+	encodeChannel(block, 0, out);
+	encodeChannel(block, 1, out + 8);
+}
+
+size_t TextureCompressor::levelSize(TextureFormat format, u32 width, u32 height) {
+	const size_t blocks = size_t((width + 3) / 4) * ((height + 3) / 4);
+	switch (format) {
+		case FormatBC1: return blocks * 8;
+		case FormatBC3:
+		case FormatBC5: return blocks * 16;
+		default: return size_t(width) * height * 4;
+	}
+}
+
+GLenum TextureCompressor::glFormat(TextureFormat format) {
+	switch (format) {
+		case FormatBC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		case FormatBC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		case FormatBC5: return GL_COMPRESSED_RG_RGTC2;
+		default: return GL_RGBA8;
+	}
+}
+
+bool TextureCompressor::supported(TextureFormat format) {
+	static bool s3tc = [] {
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; i++) {
+			const char* ext = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+			if (ext && std::strcmp(ext, "GL_EXT_texture_compression_s3tc") == 0) return true;
+		}
+		return false;
+	}();
+
+	switch (format) {
+		case FormatBC1:
+		case FormatBC3: return s3tc;
+		default: return true;
+	}
+}
+
+static void encodeLevel(ImageData& img, TextureFormat format, Vec<u8>& out) {
+	const u32 w = img.width(), h = img.height();
+	out.resize(TextureCompressor::levelSize(format, w, h));
+	if (format == FormatRGBA8) {
+		std::memcpy(out.data(), img.pixels(), out.size());
+		return;
+	}
+
+	const u32 blocksX = (w + 3) / 4, blocksY = (h + 3) / 4;
+	const size_t blockBytes = format == FormatBC1 ? 8 : 16;
+	const u8* pixels = img.pixels();
+
+	ThreadPool::get().parallelFor(blocksY, 4, [&](u32 begin, u32 end) {
+		u8 block[64];
+		for (u32 by = begin; by < end; by++) {
+			for (u32 bx = 0; bx < blocksX; bx++) {
+				// Edge blocks repeat the last row/column
+				for (u32 y = 0; y < 4; y++) {
+					const u32 sy = std::min(by * 4 + y, h - 1);
+					for (u32 x = 0; x < 4; x++) {
+						const u32 sx = std::min(bx * 4 + x, w - 1);
+						std::memcpy(block + (y * 4 + x) * 4, pixels + (sy * w + sx) * 4, 4);
+					}
+				}
+
+				u8* dst = out.data() + (size_t(by) * blocksX + bx) * blockBytes;
+				switch (format) {
+					case FormatBC1: TextureCompressor::encodeBC1(block, dst); break;
+					case FormatBC3: TextureCompressor::encodeBC3(block, dst); break;
+					case FormatBC5: TextureCompressor::encodeBC5(block, dst); break;
+					default: break;
+				}
+			}
+		}
+	});
+}
+
+CompressedImage TextureCompressor::encode(ImageData& img, TextureFormat format, bool srgb) {
+	CompressedImage out{};
+	out.format = format;
+	out.width = img.width();
+	out.height = img.height();
+
+	ImageData* level = &img;
+	ImageData next;
+	for (;;) {
+		out.levels.emplace_back();
+		encodeLevel(*level, format, out.levels.back());
+		if (level->width() == 1 && level->height() == 1) break;
+
+		ImageData half = level->downsample(srgb);
+		next = std::move(half);
+		level = &next;
+	}
+	return out;
+}
+
+CompressedImage TextureCompressor::encodeCached(ImageData& img, TextureFormat format, bool srgb) {
+	if (s_cacheDirectory.empty()) {
+		return encode(img, format, srgb);
+	}
+
+	const u32 header[] = { BC_ENCODER_VERSION, u32(format), u32(srgb), img.width(), img.height() };
+	u64 key = Utils::hash(header, sizeof(header));
+	key = Utils::hash(img.pixels(), size_t(img.width()) * img.height() * 4, key);
+
+	char hex[17];
+	auto res = std::to_chars(hex, hex + 16, key, 16);
+	*res.ptr = '\0';
+	const String fileName = s_cacheDirectory + "/" + hex + ".bc";
+
+	CompressedImage out;
+	if (load(fileName, out)) {
+		return out;
+	}
+
+	out = encode(img, format, srgb);
+	std::error_code err;
+	std::filesystem::create_directories(s_cacheDirectory, err);
+	if (!save(fileName, out)) {
+		LogWarning("Could not write texture cache: \"", fileName, "\"");
+	}
+	return out;
+}
+
+bool TextureCompressor::save(const String& fileName, const CompressedImage& img) {
+	std::ofstream out(fileName, std::ios::binary);
+	if (!out) return false;
+
+	BinWriter writer;
+	writer.writeAll(
+		u32(BC_CACHE_MAGIC), u32(img.format),
+		img.width, img.height, u32(img.levels.size())
+	);
+	for (auto&& level : img.levels) {
+		writer.write(u32(level.size()));
+	}
+	out.write(reinterpret_cast<const char*>(writer.data()), writer.dataSize());
+	for (auto&& level : img.levels) {
+		out.write(reinterpret_cast<const char*>(level.data()), level.size());
+	}
+	return bool(out);
+}
+
+bool TextureCompressor::load(const String& fileName, CompressedImage& img) {
+	std::ifstream in(fileName, std::ios::binary);
+	if (!in) return false;
+
+	Vec<u8> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	const size_t headerSize = sizeof(u32) * 5;
+	if (data.size() < headerSize) return false;
+
+	BinReader reader(data.data());
+	if (reader.read<u32>() != BC_CACHE_MAGIC) return false;
+	img.format = TextureFormat(reader.read<u32>());
+	img.width = reader.read<u32>();
+	img.height = reader.read<u32>();
+	const u32 levelCount = reader.read<u32>();
+
+	size_t offset = headerSize + levelCount * sizeof(u32);
+	if (data.size() < offset) return false;
+
+	img.levels.resize(levelCount);
+	for (u32 i = 0; i < levelCount; i++) {
+		const u32 size = reader.read<u32>();
+		if (size != levelSize(img.format, img.levelWidth(i), img.levelHeight(i)) ||
+			offset + size > data.size())
+		{
+			return false;
+		}
+		img.levels[i].assign(data.begin() + offset, data.begin() + offset + size);
+		offset += size;
+	}
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#ifndef TEXTURE_COMPRESSION_H
+#define TEXTURE_COMPRESSION_H
+
+// Block compressed textures
+// BC1 (RGB, 4 bits per texel) and BC3 (RGBA, 8) for color and specular maps,
+// BC5 (RG, 8) for normal maps. Encoding is a bounding box fit per 4x4 block,
+// spread over the thread pool, and the results are kept in a disk cache so
+// only the first run with new images pays for it.
+
+#include "ImageData.h"
+#include "glad.h"
+
+// EXT_texture_compression_s3tc, every desktop driver has it but it is not core
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+enum TextureFormat {
+	FormatRGBA8 = 0,
+	FormatBC1,
+	FormatBC3,
+	FormatBC5
+};
+
+// Every mip level down to 1x1, largest first
+struct CompressedImage {
+	TextureFormat format;
+	u32 width, height;
+	Vec<Vec<u8>> levels;
+
+	u32 levelWidth(u32 level) const { return std::max(width >> level, 1u); }
+	u32 levelHeight(u32 level) const { return std::max(height >> level, 1u); }
+};
+
+class TextureCompressor {
+public:
+	// Builds the mip chain and encodes each level, FormatRGBA8 just keeps the pixels.
+	// srgb picks gamma correct filtering for the mips, see ImageData::downsample.
+	static CompressedImage encode(ImageData& img, TextureFormat format, bool srgb = true);
+
+	// Same, but looks in (and fills) the cache directory first
+	static CompressedImage encodeCached(ImageData& img, TextureFormat format, bool srgb = true);
+
+	// Blocks are 4x4 RGBA8 texels, row by row
+	static void encodeBC1(const u8 block[64], u8 out[8]);
+	static void encodeBC3(const u8 block[64], u8 out[16]);
+	static void encodeBC5(const u8 block[64], u8 out[16]);
+
+	static size_t levelSize(TextureFormat format, u32 width, u32 height);
+	static GLenum glFormat(TextureFormat format);
+
+	// Needs a current GL context
+	static bool supported(TextureFormat format);
+
+	static void cacheDirectory(const String& dir) { s_cacheDirectory = dir; }
+	static String cacheDirectory() { return s_cacheDirectory; }
+
+	static bool save(const String& fileName, const CompressedImage& img);
+	static bool load(const String& fileName, CompressedImage& img);
+
+private:
+	static String s_cacheDirectory;
+};
+
+#endif // TEXTURE_COMPRESSION_H
\ No newline at end of file
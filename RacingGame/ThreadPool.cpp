@@ -0,0 +1,95 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+static thread_local bool t_inLoop = false;
+
+ThreadPool& ThreadPool::get() {
+	static ThreadPool pool;
+	return pool;
+}
+
+ThreadPool::ThreadPool()
+	: m_generation(0), m_quit(false), m_fn(nullptr),
+	m_count(0), m_grain(1), m_next(0), m_pending(0), m_busy(0)
+{
+	// Leave a core for the window/render thread
+	u32 hw = std::thread::hardware_concurrency();
+	u32 count = hw > 2 ? hw - 2 : 1;
+	for (u32 i = 0; i < count; i++) {
+		m_workers.emplace_back(&ThreadPool::workerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_quit = true;
+	}
+	m_wake.notify_all();
+	for (auto&& worker : m_workers) {
+		worker.join();
+	}
+}
+
+void ThreadPool::parallelFor(u32 count, u32 grain, const std::function<void(u32, u32)>& fn) {
+	if (count == 0) return;
+	grain = std::max(grain, 1u);
+
+	if (t_inLoop || count <= grain || m_workers.empty()) {
+		for (u32 begin = 0; begin < count; begin += grain) {
+			fn(begin, std::min(begin + grain, count));
+		}
+		return;
+	}
+
+	std::lock_guard<std::mutex> submit(m_submitLock);
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_fn = &fn;
+		m_count = count;
+		m_grain = grain;
+		m_next.store(0, std::memory_order_relaxed);
+		m_pending.store((count + grain - 1) / grain, std::memory_order_relaxed);
+		m_generation++;
+	}
+	m_wake.notify_all();
+
+	runChunks();
+
+	// Workers may still be finishing chunks or about to read m_fn
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_done.wait(lock, [this] {
+		return m_pending.load(std::memory_order_acquire) == 0 && m_busy == 0;
+	});
+	m_fn = nullptr;
+}
+
+void ThreadPool::runChunks() {
+	t_inLoop = true;
+	for (;;) {
+		u32 begin = m_next.fetch_add(m_grain, std::memory_order_relaxed);
+		if (begin >= m_count) break;
+		(*m_fn)(begin, std::min(begin + m_grain, m_count));
+		m_pending.fetch_sub(1, std::memory_order_acq_rel);
+	}
+	t_inLoop = false;
+}
+
+void ThreadPool::workerLoop() {
+	u64 seen = 0;
+	std::unique_lock<std::mutex> lock(m_lock);
+	for (;;) {
+		m_wake.wait(lock, [&] { return m_quit || m_generation != seen; });
+		if (m_quit) return;
+		seen = m_generation;
+
+		m_busy++;
+		lock.unlock();
+		runChunks();
+		lock.lock();
+		m_busy--;
+
+		m_done.notify_one();
+	}
+}
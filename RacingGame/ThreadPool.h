@@ -0,0 +1,49 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "Collections.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Persistent workers for data parallel loops (texture encoding, mips, render jobs).
+// One loop runs at a time, the calling thread takes chunks too. Calls made from
+// inside a loop body run inline instead of waiting on the pool they occupy.
+class ThreadPool {
+public:
+	static ThreadPool& get();
+
+	// Workers plus the calling thread
+	u32 concurrency() const { return u32(m_workers.size()) + 1; }
+
+	// Calls fn(begin, end) for chunks of at most grain items covering [0, count),
+	// returns when all of them are done
+	void parallelFor(u32 count, u32 grain, const std::function<void(u32, u32)>& fn);
+
+private:
+	ThreadPool();
+	~ThreadPool();
+
+	void workerLoop();
+	void runChunks();
+
+	Vec<std::thread> m_workers;
+
+	std::mutex m_submitLock; // one loop at a time
+	std::mutex m_lock;
+	std::condition_variable m_wake, m_done;
+	u64 m_generation;
+	bool m_quit;
+
+	// Current loop
+	const std::function<void(u32, u32)>* m_fn;
+	u32 m_count, m_grain;
+	std::atomic<u32> m_next;
+	std::atomic<u32> m_pending; // chunks not finished yet
+	u32 m_busy; // workers inside runChunks, guarded by m_lock
+};
+
+#endif // THREAD_POOL_H
\ No newline at end of file
@@ -0,0 +1,43 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include "Collections.h"
+
+#include <atomic>
+
+// Lock-free hand-off of the latest value from one writer thread to one reader thread.
+// The writer fills write() and publish()es it; the reader calls acquire() and then
+// uses read() until its next acquire(). Neither side ever waits for the other, and
+// values the reader did not get to are simply skipped.
+template <typename T>
+class TripleBuffer {
+public:
+	TripleBuffer() : m_write(0), m_shared(1), m_read(2) {}
+
+	// Writer side
+	T& write() { return m_buffers[m_write]; }
+	void publish() {
+		m_write = m_shared.exchange(m_write | Fresh, std::memory_order_acq_rel) & IndexMask;
+	}
+
+	// Reader side, returns false (and keeps the current buffer) if nothing new was published
+	bool acquire() {
+		if ((m_shared.load(std::memory_order_relaxed) & Fresh) == 0) return false;
+		m_read = m_shared.exchange(m_read, std::memory_order_acq_rel) & IndexMask;
+		return true;
+	}
+	const T& read() const { return m_buffers[m_read]; }
+
+private:
+	enum {
+		IndexMask = 0x3,
+		Fresh = 0x4
+	};
+
+	Array<T, 3> m_buffers;
+	u32 m_write;
+	std::atomic<u32> m_shared;
+	u32 m_read;
+};
+
+#endif // TRIPLE_BUFFER_H
\ No newline at end of file
@@ -2,24 +2,19 @@
 #include "Logger.h"
 
 #include <ctime>
+#include <chrono>
+#include <thread>
+#include <algorithm>
 
-typedef int64_t msec_t;
 #if defined(_WIN32)
 #include <Windows.h>
 #pragma comment(lib, "winmm.lib")
 
-msec_t time_ms(void) {
-	return timeGetTime();
-}
-
-#else
-#include <sys/time.h>
-
-msec_t time_ms(void) {
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	return (msec_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
-}
+// Ask for 1ms scheduler granularity so short sleeps don't overshoot by a whole 15.6ms quantum
+static struct TimerResolution {
+	TimerResolution() { timeBeginPeriod(1); }
+	~TimerResolution() { timeEndPeriod(1); }
+} s_timerResolution;
 #endif
 
 
@@ -44,7 +39,108 @@ float Utils::random() {
 }
 
 double Utils::currentTime() {
-	return double(time_ms()) / 1000.0;
+	return double(nanoTime()) * 1e-9;
+}
+
+u64 Utils::nanoTime() {
+	return u64(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()
+	).count());
+}
+
+void Utils::sleepPrecise(double seconds) {
+	const u64 end = nanoTime() + u64(seconds * 1e9);
+	const u64 spinThreshold = 2000000; // 2ms, below that the OS sleep is too coarse
+
+	u64 now = nanoTime();
+	while (now < end) {
+		if (end - now > spinThreshold) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		} else {
+			std::this_thread::yield();
+		}
+		now = nanoTime();
+	}
+}
+
+u64 Utils::hash(const void* data, size_t size, u64 seed) {
+	const u8* bytes = static_cast<const u8*>(data);
+	u64 h = seed;
+	for (size_t i = 0; i < size; i++) {
+		h ^= bytes[i];
+		h *= 0x100000001B3ULL;
+	}
+	return h;
+}
+
+void Utils::radixSort(Vec<u64>& keys, Vec<u64>& scratch) {
+	const size_t n = keys.size();
+
+	// Clearing the histograms alone costs more than sorting a few keys
+	if (n < 256) {
+		std::sort(keys.begin(), keys.end());
+		return;
+	}
+	scratch.resize(n);
+
+	// All 8 histograms in one read of the keys
+	u32 counts[8][256] = {};
+	for (u64 key : keys) {
+		for (u32 pass = 0; pass < 8; pass++) {
+			counts[pass][(key >> (pass * 8)) & 0xFF]++;
+		}
+	}
+
+	u64* src = keys.data();
+	u64* dst = scratch.data();
+	for (u32 pass = 0; pass < 8; pass++) {
+		u32* count = counts[pass];
+		const u32 shift = pass * 8;
+		if (count[(src[0] >> shift) & 0xFF] == n) continue;
+
+		u32 offset = 0;
+		for (u32 i = 0; i < 256; i++) {
+			u32 c = count[i];
+			count[i] = offset;
+			offset += c;
+		}
+		for (size_t i = 0; i < n; i++) {
+			dst[count[(src[i] >> shift) & 0xFF]++] = src[i];
+		}
+		std::swap(src, dst);
+	}
+
+	if (src != keys.data()) {
+		keys.swap(scratch);
+	}
+}
+
+void Random::seed(u64 s) {
+	m_state = 0;
+	m_inc = (s << 1u) | 1u;
+	next();
+	m_state += s;
+	next();
+}
+
+u32 Random::next() {
+	u64 old = m_state;
+	m_state = old * 6364136223846793005ULL + m_inc;
+	u32 xorshifted = u32(((old >> 18u) ^ old) >> 27u);
+	u32 rot = u32(old >> 59u);
+	return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+}
+
+float Random::nextFloat() {
+	return float(next() >> 8) / float(1u << 24);
+}
+
+void FPSCounter::tick() {
+	u64 now = Utils::nanoTime();
+	if (m_lastTick > 0) {
+		update(float(double(now - m_lastTick) * 1e-9));
+	}
+	m_lastTick = now;
 }
 
 void FPSCounter::update(float deltaTime) {
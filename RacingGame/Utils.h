@@ -2,8 +2,113 @@
 #define UTILS_H
 
 #include "Collections.h"
+#include <algorithm>
 #include <iterator>
 #include <sstream>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+// Appends values to a caller-provided buffer without allocating, except for types
+// that only have an operator<<, which go through a std::ostringstream.
+// The text is always null terminated and cut off when the buffer is full.
+// Numbers come out the same as with a default std::ostream.
+class FormatBuffer {
+public:
+	FormatBuffer(char* data, size_t capacity)
+		: m_data(data), m_capacity(capacity), m_length(0), m_truncated(false)
+	{
+		if (m_capacity > 0) m_data[0] = '\0';
+	}
+
+	template <typename... Args>
+	FormatBuffer& write(const Args&... args) {
+		(put(args), ...);
+		return *this;
+	}
+
+	template <typename T>
+	void put(const T& value) {
+		using D = std::decay_t<T>;
+		if constexpr (std::is_same_v<D, bool>) {
+			append(value ? "1" : "0", 1);
+		} else if constexpr (std::is_same_v<D, char>) {
+			append(&value, 1);
+		} else if constexpr (std::is_enum_v<D>) {
+			number(i64(value));
+		} else if constexpr (std::is_integral_v<D>) {
+			number(value);
+		} else if constexpr (std::is_floating_point_v<D>) {
+			real(double(value));
+		} else if constexpr (std::is_same_v<D, const char*> || std::is_same_v<D, char*>) {
+			if (value != nullptr) append(value, std::strlen(value));
+		} else if constexpr (std::is_same_v<D, String>) {
+			append(value.data(), value.size());
+		} else {
+			std::ostringstream oss;
+			oss << value;
+			const String str = oss.str();
+			append(str.data(), str.size());
+		}
+	}
+
+	void clear() {
+		m_length = 0;
+		m_truncated = false;
+		if (m_capacity > 0) m_data[0] = '\0';
+	}
+
+	const char* c_str() const { return m_data; }
+	size_t size() const { return m_length; }
+	bool truncated() const { return m_truncated; }
+
+private:
+	char* m_data;
+	size_t m_capacity, m_length;
+	bool m_truncated;
+
+	template <typename T>
+	void number(T value) {
+		char tmp[32];
+		auto res = std::to_chars(tmp, tmp + sizeof(tmp), value);
+		append(tmp, size_t(res.ptr - tmp));
+	}
+
+	// Floating point std::to_chars needs VS2019, "%g" is what std::ostream prints
+	void real(double value) {
+		char tmp[32];
+		int length = std::snprintf(tmp, sizeof(tmp), "%g", value);
+		if (length > 0) append(tmp, std::min(size_t(length), sizeof(tmp) - 1));
+	}
+
+	void append(const char* str, size_t length) {
+		if (m_capacity == 0) {
+			m_truncated = m_truncated || length > 0;
+			return;
+		}
+		size_t space = m_capacity - 1 - m_length;
+		if (length > space) {
+			length = space;
+			m_truncated = true;
+		}
+		std::memcpy(m_data + m_length, str, length);
+		m_length += length;
+		m_data[m_length] = '\0';
+	}
+};
+
+// FormatBuffer with its own storage, for building short strings on the stack
+template <u32 N>
+class FixedString : public FormatBuffer {
+public:
+	FixedString() : FormatBuffer(m_storage, N) {}
+	FixedString(const FixedString&) = delete;
+	FixedString& operator=(const FixedString&) = delete;
+
+private:
+	char m_storage[N];
+};
 
 class Utils {
 public:
@@ -20,23 +125,74 @@ public:
 	static Vec<String> split(const String &s, char delim);
 
 	template<typename... Args>
-	static String concat(Args&&... args) {
-		std::stringstream ss;
-		(ss << ... << args);
-		return ss.str();
+	static String concat(const Args&... args) {
+		FixedString<256> small;
+		small.write(args...);
+		if (!small.truncated()) {
+			return String(small.c_str(), small.size());
+		}
+
+		String str(1024, '\0');
+		while (true) {
+			FormatBuffer buf(&str[0], str.size());
+			buf.write(args...);
+			if (!buf.truncated()) {
+				str.resize(buf.size());
+				return str;
+			}
+			str.resize(str.size() * 2);
+		}
+	}
+
+	// Writes into buf (null terminated, truncated to size) and returns the length
+	template<typename... Args>
+	static size_t format(char* buf, size_t size, const Args&... args) {
+		return FormatBuffer(buf, size).write(args...).size();
 	}
 
 	static String currentDateTime(const String& fmt = "%m/%d/%Y %X");
 
 	static float random();
+
+	// Monotonic clock, seconds
 	static double currentTime();
 
+	// Monotonic clock, nanoseconds
+	static u64 nanoTime();
+
+	// Sleeps most of the interval and yields for the last couple of milliseconds
+	static void sleepPrecise(double seconds);
+
+	// FNV-1a, chainable through the seed
+	static u64 hash(const void* data, size_t size, u64 seed = 0xCBF29CE484222325ULL);
+
+	// LSD radix sort, 8 bits per pass. Passes where every key has the same
+	// byte are skipped, short arrays use std::sort. scratch can be reused.
+	static void radixSort(Vec<u64>& keys, Vec<u64>& scratch);
+
+};
+
+// Seeded PCG32 generator. Same seed, same sequence on every platform,
+// unlike rand(), so it can be used by anything that affects the simulation.
+class Random {
+public:
+	Random(u64 s = 0) { seed(s); }
+
+	void seed(u64 s);
+	u32 next();
+	float nextFloat(); // [0, 1)
+
+private:
+	u64 m_state, m_inc;
 };
 
 #define FPS_COUNTER_SAMPLES 32
 class FPSCounter {
 public:
-	FPSCounter() : m_sample(0), m_time(0) {}
+	FPSCounter() : m_fps(0), m_time(0), m_samples{}, m_sample(0), m_lastTick(0) {}
+
+	// Measures the time since the last call with Utils::nanoTime()
+	void tick();
 	void update(float deltaTime);
 
 	float get() const;
@@ -45,6 +201,7 @@ private:
 	float m_fps, m_time;
 	float m_samples[FPS_COUNTER_SAMPLES];
 	u32 m_sample;
+	u64 m_lastTick;
 };
 
 #endif // UTILS_H
\ No newline at end of file
@@ -2,10 +2,27 @@
 #include "Car.h"
 #include "Camera.h"
 
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <cfloat>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
 class MainScene : public Scene {
 public:
 	void create() {
 		auto&& am = Engine::get()->assetManager();
+
+		staticGeometry().cursor()
+			.region(glm::vec4(0, 0, 32, 32))
+			.position(glm::vec3(0.0f, 0.0f, -0.01f))
+			.scale(glm::vec2(32.0f));
+		staticGeometry().addSprite(am->getTexture("textures/floor.tga"), Texture2D(), Texture2D());
+
 		m_car = new Car();
 		m_car->addBehavior(new CarAI());
 		m_car->loadSkin("bmw850");
@@ -26,14 +43,266 @@ public:
 		m_camera = new Camera();
 		m_camera->target(m_car);
 		add(m_camera);
+
+		lodFocus(m_camera);
 	}
 
 	Car *m_car;
 	Camera *m_camera;
 };
 
+#ifdef SNAPSHOT_BENCH
+// Builds that define SNAPSHOT_BENCH time Scene::saveState/restoreState from onInit
+// with 100 cars, spread out (no contacts) and piled up, and log the results.
+class SnapshotBenchScene : public Scene {
+public:
+	SnapshotBenchScene(float spacing) : m_spacing(spacing) { seed(42); }
+
+	void create() {
+		for (u32 i = 0; i < 100; i++) {
+			Car *car = new Car();
+			car->addBehavior(new CarBehavior());
+			car->position(glm::vec3(float(i % 10), float(i / 10) * 0.5f, 0.0f) * m_spacing);
+			add(car);
+		}
+	}
+
+private:
+	float m_spacing;
+};
+
+static void benchSnapshots() {
+	const float dt = 1.0f / 60.0f;
+	const u32 runs = 5, iterations = 2000, replayTicks = 10;
+
+	for (float spacing : { 5.0f, 0.9f }) {
+		SceneManager sm;
+		sm.registerScene("bench", new SnapshotBenchScene(spacing));
+		for (u32 i = 0; i <= 10; i++) sm.update(dt);
+		Scene *scene = sm.current();
+
+		u32 contacts = 0;
+		for (b2Contact *c = scene->physicsWorld()->GetContactList(); c; c = c->GetNext()) {
+			if (c->IsTouching()) contacts++;
+		}
+
+		BinWriter record;
+		double save = 1e30, restore = 1e30;
+		bool restored = true;
+		for (u32 r = 0; r < runs; r++) {
+			double start = Utils::currentTime();
+			for (u32 i = 0; i < iterations; i++) {
+				record.clear();
+				scene->saveState(record);
+			}
+			save = std::min(save, (Utils::currentTime() - start) / iterations);
+
+			start = Utils::currentTime();
+			for (u32 i = 0; i < iterations; i++) {
+				restored = scene->restoreState(record.data(), record.dataSize()) && restored;
+			}
+			restore = std::min(restore, (Utils::currentTime() - start) / iterations);
+		}
+
+		// Tick hashes after the first and second rollback to the same record.
+		// The first replay runs after the timing loop already restored it.
+		Vec<u64> first, second;
+		for (Vec<u64>* hashes : { &first, &second }) {
+			scene->restoreState(record.data(), record.dataSize());
+			for (u32 i = 0; i < replayTicks; i++) {
+				sm.update(dt);
+				hashes->push_back(scene->stateHash());
+			}
+		}
+
+		LogInfo(
+			"Snapshot bench: 100 cars, ", contacts, " touching contacts, ",
+			record.dataSize(), " bytes, save ", save * 1e6, " us, restore ", restore * 1e6, " us, ",
+			restored ? "restored" : "REJECTED", ", rollback replay ",
+			first == second ? "identical" : "DIFFERS"
+		);
+	}
+}
+#endif
+
+#ifdef LOGGER_BENCH
+// Builds that define LOGGER_BENCH log from 8 threads at once instead of starting the
+// game, then do the same writing each line synchronously under a lock, the way the
+// logger used to. Use a release build so both go to a file.
+static void benchLogger() {
+	const u32 threads = 8, perThread = 200000;
+	const u32 calls = threads * perThread;
+	// Each thread waits for the writer after this many records, so the ring
+	// never overflows and the time includes writing every record
+	const u32 batch = LOG_RING_SIZE / threads;
+
+	auto run = [&](auto&& logLine) {
+		Vec<std::thread> pool;
+		for (u32 t = 0; t < threads; t++) {
+			pool.emplace_back([&, t]() {
+				for (u32 i = 0; i < perThread; i++) logLine(t, i);
+			});
+		}
+		for (auto&& th : pool) th.join();
+	};
+
+	const u64 dropped = LOGGER.dropped();
+	double start = Utils::currentTime();
+	run([&](u32 t, u32 i) {
+		LogInfo("Logger bench: thread ", t, " message ", i, " value ", float(i) * 0.5f);
+		if ((i + 1) % batch == 0) LOGGER.flush();
+	});
+	LOGGER.flush();
+	const double async = Utils::currentTime() - start;
+
+	std::ofstream file("logger_bench_sync.txt");
+	std::mutex lock;
+	start = Utils::currentTime();
+	run([&](u32 t, u32 i) {
+		String msg = Utils::concat("Logger bench: thread ", t, " message ", i, " value ", float(i) * 0.5f);
+		String prefix = "[" + Utils::currentDateTime() + "] [INFO] [main.cpp(benchLogger @ " + std::to_string(__LINE__) + ")] ";
+		std::lock_guard<std::mutex> guard(lock);
+		file << prefix << msg << std::endl;
+	});
+	const double sync = Utils::currentTime() - start;
+	file.close();
+	std::remove("logger_bench_sync.txt");
+
+	LogInfo(
+		"Logger bench: ", threads, " threads, ", calls, " calls, ",
+		u32(calls / async), " calls/s written, ", LOGGER.dropped() - dropped, " dropped; ",
+		"synchronous ", u32(calls / sync), " calls/s"
+	);
+	LOGGER.flush();
+}
+#endif
+
+#ifdef MESH_BENCH
+// Builds that define MESH_BENCH time the Mesh kernels on grids of 1k to 1M vertices
+// instead of starting the game. The reference is the glm code Mesh.cpp falls back
+// to without SSE2, and the results must match it byte for byte.
+namespace meshbench {
+	void transform(Vec<Vertex>& verts, const glm::mat4& m, glm::vec3& lo, glm::vec3& hi) {
+		lo = glm::vec3(FLT_MAX);
+		hi = glm::vec3(-FLT_MAX);
+		for (Vertex& v : verts) {
+			v.position = glm::vec3(m * glm::vec4(v.position, 1.0f));
+			lo = glm::min(lo, v.position);
+			hi = glm::max(hi, v.position);
+		}
+	}
+
+	void normals(Vec<Vertex>& verts, const Vec<u32>& inds) {
+		for (u32 i = 0; i < inds.size(); i += 3) {
+			Vertex& v0 = verts[inds[i + 0]];
+			Vertex& v1 = verts[inds[i + 1]];
+			Vertex& v2 = verts[inds[i + 2]];
+			glm::vec3 n = glm::normalize(glm::cross(v2.position - v0.position, v1.position - v0.position));
+			v0.normal += n;
+			v1.normal += n;
+			v2.normal += n;
+		}
+		for (Vertex& v : verts) v.normal = glm::normalize(v.normal);
+	}
+
+	void tangents(Vec<Vertex>& verts, const Vec<u32>& inds) {
+		for (u32 i = 0; i < inds.size(); i += 3) {
+			Vertex& v0 = verts[inds[i + 0]];
+			Vertex& v1 = verts[inds[i + 1]];
+			Vertex& v2 = verts[inds[i + 2]];
+			glm::vec2 deltaUV1 = v2.texCoord - v0.texCoord;
+			glm::vec2 deltaUV2 = v1.texCoord - v0.texCoord;
+			float f = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
+			glm::vec3 edge1 = v2.position - v0.position;
+			glm::vec3 edge2 = v1.position - v0.position;
+			glm::vec3 tang{};
+			tang.x = f * (deltaUV2.y * edge1.x - deltaUV1.y * edge2.x);
+			tang.y = f * (deltaUV2.y * edge1.y - deltaUV1.y * edge2.y);
+			tang.z = f * (deltaUV2.y * edge1.z - deltaUV1.y * edge2.z);
+			tang = glm::normalize(tang);
+			v0.tangent += tang;
+			v1.tangent += tang;
+			v2.tangent += tang;
+		}
+		for (Vertex& v : verts) v.tangent = glm::normalize(v.tangent);
+	}
+
+	// Best of `runs`, in microseconds
+	template <typename F>
+	double best(u32 runs, F&& f) {
+		double result = 1e30;
+		for (u32 r = 0; r < runs; r++) {
+			double start = Utils::currentTime();
+			f();
+			result = std::min(result, (Utils::currentTime() - start) * 1e6);
+		}
+		return result;
+	}
+}
+
+static void benchMesh() {
+	using namespace meshbench;
+	const glm::mat4 model = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(1, 2, 3)), 0.7f, glm::vec3(0.3f, 0.5f, 0.8f));
+
+	for (u32 n : { 32u, 100u, 317u, 1000u }) {
+		Vec<Vertex> verts;
+		Vec<u32> inds;
+		for (u32 y = 0; y < n; y++) {
+			for (u32 x = 0; x < n; x++) {
+				Vertex v{};
+				v.position = glm::vec3(float(x), float(y), std::sin(x * 0.1f) * std::cos(y * 0.13f));
+				v.texCoord = glm::vec2(float(x) / n, float(y) / n);
+				v.color = glm::vec4(1.0f);
+				verts.push_back(v);
+			}
+		}
+		for (u32 y = 0; y + 1 < n; y++) {
+			for (u32 x = 0; x + 1 < n; x++) {
+				u32 a = y * n + x, b = a + 1, c = a + n, d = c + 1;
+				inds.insert(inds.end(), { a, b, d, a, d, c });
+			}
+		}
+
+		const u32 runs = n >= 1000 ? 5 : 20;
+		Vec<Vertex> ref;
+		Mesh mesh;
+		mesh.indices(inds);
+		glm::vec3 lo, hi;
+
+		// Each run starts from a fresh copy, which is timed on its own and taken out
+		const double refCopy = best(runs, [&] { ref = verts; });
+		const double meshCopy = best(runs, [&] { mesh.vertices(verts); });
+		auto same = [&] { return std::memcmp(ref.data(), mesh.vertices().data(), ref.size() * sizeof(Vertex)) == 0; };
+
+		const double refTransform = best(runs, [&] { ref = verts; transform(ref, model, lo, hi); }) - refCopy;
+		const double simdTransform = best(runs, [&] { mesh.vertices(verts); mesh.transform(model); }) - meshCopy;
+		bool identical = same() && lo == mesh.boundsMin() && hi == mesh.boundsMax();
+
+		const double refNormals = best(runs, [&] { ref = verts; normals(ref, inds); }) - refCopy;
+		const double simdNormals = best(runs, [&] { mesh.vertices(verts); mesh.calculateNormals(); }) - meshCopy;
+		identical = identical && same();
+
+		const double refTangents = best(runs, [&] { ref = verts; tangents(ref, inds); }) - refCopy;
+		const double simdTangents = best(runs, [&] { mesh.vertices(verts); mesh.calculateTangents(); }) - meshCopy;
+		identical = identical && same();
+
+		LogInfo(
+			"Mesh bench: ", n * n, " vertices, transform ", refTransform, " -> ", simdTransform,
+			" us, normals ", refNormals, " -> ", simdNormals,
+			" us, tangents ", refTangents, " -> ", simdTangents, " us, ",
+			identical ? "bit-identical" : "DIFFERENT"
+		);
+	}
+	LOGGER.flush();
+}
+#endif
+
 class RacingGame : public Application {
 public:
+	// Debug builds: --check-determinism <ticks> replays the first ticks of the
+	// main scene and logs whether every tick hashes the same (see Engine::checkDeterminism)
+	u32 determinismTicks{ 0 };
+
 	void onPreLoad() {
 		auto&& am = Engine::get()->assetManager();
 		am->init("data.zip");
@@ -50,6 +319,14 @@ public:
 		ctx->environment(reflTex);
 
 		sm->registerScene("main", new MainScene());
+
+#ifdef SNAPSHOT_BENCH
+		benchSnapshots();
+#endif
+
+		if (determinismTicks > 0) {
+			Engine::get()->checkDeterminism(determinismTicks);
+		}
 	}
 
 	void onRender(RenderContext *context) {
@@ -63,6 +340,20 @@ public:
 };
 
 int main(int argc, char** argv) {
-	Engine::get()->start(new RacingGame(), "Racing Game", 1024, 640);
+#if defined(LOGGER_BENCH)
+	benchLogger();
+#elif defined(MESH_BENCH)
+	benchMesh();
+#else
+	RacingGame *game = new RacingGame();
+#ifdef _DEBUG
+	for (int i = 1; i + 1 < argc; i++) {
+		if (std::strcmp(argv[i], "--check-determinism") == 0) {
+			game->determinismTicks = u32(std::strtoul(argv[i + 1], nullptr, 10));
+		}
+	}
+#endif
+	Engine::get()->start(game, "Racing Game", 1024, 640);
+#endif
 	return 0;
 }
\ No newline at end of file
@@ -19,25 +19,44 @@ in DATA {
 	vec3 tangent;
 	vec3 eye;
 	vec2 uv;
+	flat float layer;
 	mat3 tbn;
 } FSIn;
 
 uniform mat4 uView;
 
-uniform sampler2D uColor;
+// Specialized with HAS_NORMAL_MAP, HAS_SPECULAR_MAP, HAS_ENVIRONMENT and
+// HAS_SUN/POINT/SPOT_LIGHTS (see RenderContext::ShaderFeature)
 
-uniform sampler2D uNormal;
-uniform bool uHasNormal;
+// HAS_TEXTURE_ARRAY: the material is a layer of array textures, picked per vertex
+#ifdef HAS_TEXTURE_ARRAY
+#define MaterialSampler sampler2DArray
+#define MATERIAL_UV vec3(FSIn.uv, FSIn.layer)
+#else
+#define MaterialSampler sampler2D
+#define MATERIAL_UV FSIn.uv
+#endif
 
-uniform sampler2D uSpecular;
-uniform bool uHasSpecular;
+uniform MaterialSampler uColor;
 
+#ifdef HAS_NORMAL_MAP
+uniform MaterialSampler uNormal;
+#endif
+
+#ifdef HAS_SPECULAR_MAP
+uniform MaterialSampler uSpecular;
+#endif
+
+#ifdef HAS_ENVIRONMENT
 uniform sampler2D uEnv;
-uniform bool uHasEnv;
+#endif
 
+// Sorted by type: suns, then points, then spots
 uniform vec3 uAmbient = vec3(0.0);
 uniform Light uLights[32];
-uniform int uLightCount;
+uniform int uSunCount;
+uniform int uPointCount;
+uniform int uSpotCount;
 
 float sqr1(float x) { return x * x; }
 
@@ -54,90 +73,102 @@ vec3 gamma(vec3 col) {
 	return pow(col, vec3(1.0 / 2.2));
 }
 
+vec3 shade(Light light, vec3 N, vec3 L, vec3 V, float att, float shininess, float specIntens) {
+	if (att <= 0.0) {
+		return vec3(0.0);
+	}
+
+	float NoL = dot(N, L);
+	float nl = clamp(NoL, 0.0, 1.0);
+	float fact = att * nl;
+	float spec = 0.0;
+	if (NoL > 0.0) {
+		vec3 H = normalize(L + V);
+		spec = pow(dot(N, H), 5.0 + shininess * 250.0) * specIntens;
+	}
+	vec3 specular = (spec * light.color);
+	return ((light.color * light.intensity) + specular) * fact;
+}
+
 vec3 calcLighting(vec3 N, float shininess, float specIntens) {
 	vec3 lighting = vec3(0.0);
 	vec3 P = FSIn.position.xyz;
 	vec3 V = FSIn.eye;
-	for (int i = 0; i < uLightCount; i++) {
+	int first = 0;
+
+#ifdef HAS_SUN_LIGHTS
+	for (int i = first; i < first + uSunCount; i++) {
 		Light light = uLights[i];
-		if (light.type == 0) {
-			continue;
-		}
-
-		vec3 L = vec3(0.0);
-		float att = 0.0;
-		vec3 Lp = light.position;
-
-		if (light.type == 1) { // SUN
-			L = -light.direction;
-			att = 1.0;
-		} else if (light.type == 2) { // POINT
-			L = Lp - P;
-			float dist = length(L); L = normalize(L);
-
-			if (dist < light.radius) {
-				att = lightAttenuation(light, L, dist);
-			} else { att = 0.0; }
-		} else if (light.type == 3) { // SPOT
-			L = Lp - P;
-			float dist = length(L);
-			L = normalize(L);
-
-			att = lightAttenuation(light, L, dist);
-			float S = dot(L, normalize(-light.direction));
-			float c = cos(light.spotCutoff);
-			if (S > c) {
-				att *= (1.0 - (1.0 - S) * 1.0 / (1.0 - c));
-			} else {
-				att = 0.0;
-			}
-		}
-
-		float NoL = dot(N, L);
-		if (att > 0.0) {
-			float nl = clamp(NoL, 0.0, 1.0);
-			float fact = att * nl;
-			float spec = 0.0;
-			if (NoL > 0.0) {
-				vec3 H = normalize(L + V);
-				spec = pow(dot(N, H), 5.0 + shininess * 250.0) * specIntens;
-			}
-			vec3 specular = (spec * light.color);
-
-			lighting += ((light.color * light.intensity) + specular) * fact;
-		}
+		lighting += shade(light, N, -light.direction, V, 1.0, shininess, specIntens);
 	}
+	first += uSunCount;
+#endif
+
+#ifdef HAS_POINT_LIGHTS
+	for (int i = first; i < first + uPointCount; i++) {
+		Light light = uLights[i];
+		vec3 L = light.position - P;
+		float dist = length(L);
+		L = normalize(L);
+
+		// Zero past the radius
+		float att = lightAttenuation(light, L, dist);
+		lighting += shade(light, N, L, V, att, shininess, specIntens);
+	}
+	first += uPointCount;
+#endif
+
+#ifdef HAS_SPOT_LIGHTS
+	for (int i = first; i < first + uSpotCount; i++) {
+		Light light = uLights[i];
+		vec3 L = light.position - P;
+		float dist = length(L);
+		L = normalize(L);
+
+		float S = dot(L, normalize(-light.direction));
+		float c = cos(light.spotCutoff);
+		float cone = clamp((S - c) / (1.0 - c), 0.0, 1.0);
+		float att = lightAttenuation(light, L, dist) * cone;
+		lighting += shade(light, N, L, V, att, shininess, specIntens);
+	}
+#endif
+
 	return (uAmbient + lighting);
 }
 
 void main() {
+#ifdef HAS_NORMAL_MAP
+	// Z is rebuilt, two channel (BC5) normal maps only store X and Y
+	vec3 Nt;
+	Nt.xy = texture(uNormal, MATERIAL_UV).xy * 2.0 - 1.0;
+	Nt.z = sqrt(max(1.0 - dot(Nt.xy, Nt.xy), 0.0));
+	vec3 N = normalize(FSIn.tbn * Nt);
+#else
 	vec3 N = FSIn.normal;
-	vec4 S = vec4(vec3(0.0), 1.0);
-	if (uHasNormal) {
-		vec3 Nt = texture(uNormal, FSIn.uv).xyz * 2.0 - 1.0;
-		N = normalize(FSIn.tbn * Nt);
-	}
+#endif
 
-	if (uHasSpecular) {
-		S = texture(uSpecular, FSIn.uv);
-	}
+#ifdef HAS_SPECULAR_MAP
+	vec4 S = texture(uSpecular, MATERIAL_UV);
+#else
+	vec4 S = vec4(vec3(0.0), 1.0);
+#endif
 	
 	float shininess = clamp(S.r, 0.0, 1.0);
 	float specIntens = S.g;
 
-	vec4 color = texture(uColor, FSIn.uv);
+	vec4 color = texture(uColor, MATERIAL_UV);
 	color.rgb *= mix(vec3(1.0), FSIn.color.rgb, S.b);
 	if (color.a < 0.6) {
 		discard;
 	}
 
 	vec3 env = vec3(0.0);
-	if (uHasEnv) {
-		float f0 = rim(N, FSIn.eye, 0.0, 0.6, 1.0);
-		vec2 uv = vec2(uView * vec4(N, 0.0)) * 0.5 + 0.5;
-		uv.y = 1.0 - uv.y;
-		env = gamma(texture(uEnv, uv, (1.0 - shininess) * 3.0).rgb) * shininess * f0;
-	}
+#ifdef HAS_ENVIRONMENT
+	float f0 = rim(N, FSIn.eye, 0.0, 0.6, 1.0);
+	vec2 envUV = vec2(uView * vec4(N, 0.0)) * 0.5 + 0.5;
+	envUV.y = 1.0 - envUV.y;
+	env = gamma(texture(uEnv, envUV, (1.0 - shininess) * 3.0).rgb) * shininess * f0;
+#endif
 
 	vec3 lighting = calcLighting(N, shininess, specIntens) * S.a;
 	fragColor = vec4(lighting * (color.rgb + env), color.a);
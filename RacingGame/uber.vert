@@ -1,10 +1,16 @@
 R"(
 #version 330 core
 layout (location = 0) in vec3 vPosition;
+#ifdef HAS_COMPACT_VERTEX
+layout (location = 1) in vec2 vNormalOct;
+layout (location = 2) in vec2 vTangentOct;
+#else
 layout (location = 1) in vec3 vNormal;
 layout (location = 2) in vec3 vTangent;
+#endif
 layout (location = 3) in vec2 vTexCoord;
 layout (location = 4) in vec4 vColor;
+layout (location = 5) in float vLayer;
 
 uniform mat4 uProj;
 uniform mat4 uView;
@@ -17,10 +23,26 @@ out DATA {
 	vec3 tangent;
 	vec3 eye;
 	vec2 uv;
+	flat float layer;
 	mat3 tbn;
 } VSOut;
 
+#ifdef HAS_COMPACT_VERTEX
+// See octEncode in Mesh.cpp
+vec3 octDecode(vec2 e) {
+	vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (v.z < 0.0) {
+		v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(v);
+}
+#endif
+
 void main() {
+#ifdef HAS_COMPACT_VERTEX
+	vec3 vTangent = octDecode(vTangentOct);
+#endif
+
 	vec4 pos = uModel * vec4(vPosition, 1.0);
 	gl_Position = uProj * uView * pos;
 
@@ -29,6 +51,7 @@ void main() {
 	VSOut.color = vColor;
 	VSOut.position = pos;
 	VSOut.uv = vTexCoord;
+	VSOut.layer = vLayer;
 	
 	const vec3 NORMAL = vec3(0.0, 0.0, 1.0);
 	VSOut.normal = NORMAL;